@@ -0,0 +1,83 @@
+#!/bin/bash
+
+# Measures the latency of kill and jobs as the number of background jobs
+# grows. Each run starts the given number of background jobs and then either
+# sends signal 0 to the most recent one many times or lists every job a number
+# of times. The time spent starting the jobs is measured separately and
+# subtracted. Steps that need more processes than the user may create are
+# skipped.
+#
+# Usage: bench/job_table.bash [number of kill commands] [number of jobs commands]
+
+if [ ! -e "./quash" ]; then
+    echo "Build quash and run this script from the top directory"
+    exit 1
+fi
+
+KILLS=${1:-20000}
+LISTINGS=${2:-20}
+SCRIPT=$(mktemp)
+
+# Write a script starting $1 background jobs followed by $3 copies of the
+# command $2. Quash expects the final line to end at the end of the file rather
+# than with a newline.
+gen_script() {
+    # $1 - Number of background jobs
+    # $2 - Command to time
+    # $3 - Number of times to run it
+
+    # Every job has to be running rather than waiting for a job slot
+    echo "set -o maxjobs $(( $1 + 1 ))"
+    for ((i = 0; i < $1; ++i)); do
+        echo "sleep 30 &"
+    done
+    for ((i = 0; i < $3; ++i)); do
+        echo "$2"
+    done
+    printf "echo done"
+}
+
+# Run a generated script and kill the jobs it left behind
+# RETURN: Nanoseconds taken
+time_script() {
+    local start=$(date +%s%N)
+    setsid ./quash < $SCRIPT > /dev/null 2>&1 &
+    local pid=$!
+    wait $pid
+    local end=$(date +%s%N)
+
+    # Without a terminal the jobs stay in the process group of quash, which
+    # setsid made a group of its own. Nothing else on the host is touched.
+    kill -9 -- -$pid 2> /dev/null
+
+    echo $(( end - start ))
+}
+
+# Processes the user may still create
+room=$(cat /proc/sys/kernel/pid_max)
+procs=$(ulimit -u)
+if [ "$procs" != "unlimited" ] && (( procs < room )); then
+    room=$procs
+fi
+room=$(( room - $(ps -e --no-headers | wc -l) ))
+
+for JOBS in 10 100 1000 10000 100000; do
+    if (( JOBS + 100 > room )); then
+        echo "$JOBS jobs: skipped, only $room more processes may be created"
+        continue
+    fi
+
+    gen_script $JOBS "" 0 > $SCRIPT
+    base=$(time_script)
+
+    gen_script $JOBS "kill 0 $JOBS" $KILLS > $SCRIPT
+    kill=$(time_script)
+
+    gen_script $JOBS "jobs" $LISTINGS > $SCRIPT
+    list=$(time_script)
+
+    echo "$JOBS jobs: $(( (kill - base) / KILLS )) ns/kill," \
+         "$(( (list - base) / (LISTINGS * JOBS) )) ns/job listed"
+done
+
+rm -f $SCRIPT
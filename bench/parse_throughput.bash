@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Measures how many lines per second quash can parse in script mode. Every line
+# is a kill of a job that does not exist, which parses into a full command
+# structure but does almost no work when it runs.
+#
+# Usage: bench/parse_throughput.bash [number of lines]
+
+if [ ! -e "./quash" ]; then
+    echo "Build quash and run this script from the top directory"
+    exit 1
+fi
+
+COUNT=${1:-1000000}
+SCRIPT=$(mktemp)
+
+# Quash expects the final line to end at the end of the file rather than with
+# a newline
+yes 'kill 15 999' | head -n $COUNT > $SCRIPT
+truncate -s -1 $SCRIPT
+
+start=$(date +%s%N)
+./quash < $SCRIPT > /dev/null
+end=$(date +%s%N)
+
+elapsed_us=$(( (end - start) / 1000 ))
+
+echo "Parsed $COUNT lines in $(( elapsed_us / 1000 )) ms"
+echo "$(( COUNT * 1000000 / elapsed_us )) lines/second"
+
+rm -f $SCRIPT
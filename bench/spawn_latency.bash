@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Measures the average latency of starting an external command from quash with
+# the posix_spawn() path and with the fork() fallback path.
+#
+# Usage: bench/spawn_latency.bash [number of commands]
+
+if [ ! -e "./quash" ]; then
+    echo "Build quash and run this script from the top directory"
+    exit 1
+fi
+
+COUNT=${1:-5000}
+SCRIPT=$(mktemp)
+
+# Generate a script of short lived commands. Quash expects the final line to
+# end at the end of the file rather than with a newline.
+for ((i = 1; i < COUNT; ++i)); do
+    echo "/bin/true"
+done > $SCRIPT
+printf "/bin/true" >> $SCRIPT
+
+# Run the script with a given spawn mode
+# RETURN: Average microseconds per command
+time_mode() {
+    # $1 - Value of QUASH_SPAWN
+
+    local start=$(date +%s%N)
+    QUASH_SPAWN=$1 ./quash < $SCRIPT > /dev/null
+    local end=$(date +%s%N)
+
+    echo $(( (end - start) / COUNT / 1000 ))
+}
+
+echo "Spawning $COUNT commands"
+echo "posix_spawn: $(time_mode spawn) us/command"
+echo "fork:        $(time_mode fork) us/command"
+
+rm -f $SCRIPT
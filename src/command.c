@@ -6,9 +6,11 @@
 
 #include "command.h"
 
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 // Move the created command into a holder
 CommandHolder mk_command_holder(char* redirect_in,
@@ -72,14 +74,76 @@ Command mk_cd_command(char* dir) {
   return cmd;
 }
 
+/**
+ * @brief A signal name accepted by the kill command
+ */
+typedef struct SignalName {
+  const char* name; /**< Name without the SIG prefix */
+  int sig;          /**< Signal number */
+} SignalName;
+
+static const SignalName signal_names[] = {
+  { "HUP",  SIGHUP  }, { "INT",  SIGINT  }, { "QUIT", SIGQUIT }, { "ILL",  SIGILL  },
+  { "TRAP", SIGTRAP }, { "ABRT", SIGABRT }, { "BUS",  SIGBUS  }, { "FPE",  SIGFPE  },
+  { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "SEGV", SIGSEGV }, { "USR2", SIGUSR2 },
+  { "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CHLD", SIGCHLD },
+  { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN },
+  { "TTOU", SIGTTOU }, { "URG",  SIGURG  }, { "XCPU", SIGXCPU }, { "XFSZ", SIGXFSZ },
+  { "VTALRM", SIGVTALRM }, { "PROF", SIGPROF }, { "WINCH", SIGWINCH },
+  { "IO",   SIGIO   }, { "SYS",  SIGSYS  }, { NULL, 0 }
+};
+
+// Parse a whole string as a non-negative number. Returns -1 on failure.
+static int __parse_number(const char* str) {
+  char* end;
+  long num;
+
+  if (*str < '0' || *str > '9')
+    return -1;
+
+  num = strtol(str, &end, 10);
+
+  return (*end != '\0' || num > 0x7fffffff) ? -1 : (int) num;
+}
+
+// Parse a signal given as a number or a name such as TERM, SIGTERM or -TERM.
+// Returns -1 if the signal is not valid.
+static int __parse_signal(const char* str) {
+  if (*str == '-')
+    ++str;
+
+  int sig = __parse_number(str);
+
+  if (sig >= 0)
+    return (sig < NSIG) ? sig : -1;
+
+  if (strncasecmp(str, "SIG", 3) == 0)
+    str += 3;
+
+  for (const SignalName* s = signal_names; s->name != NULL; ++s)
+    if (strcasecmp(str, s->name) == 0)
+      return s->sig;
+
+  return -1;
+}
+
+// Parse a job given as a job id or a %N job spec. Returns -1 if the job is not
+// valid.
+static int __parse_job_spec(const char* str) {
+  if (*str == '%')
+    ++str;
+
+  return __parse_number(str);
+}
+
 // Create KillCommand structure
 Command mk_kill_command(char* sig, char* job) {
   Command cmd;
 
   cmd.kill = (KillCommand) {
     KILL,
-    strtol(sig, NULL, 10),
-    strtol(job, NULL, 10),
+    (sig != NULL) ? __parse_signal(sig) : SIGTERM,
+    __parse_job_spec(job),
     sig,
     job
   };
@@ -99,11 +163,12 @@ Command mk_pwd_command() {
 }
 
 // Create JobCommand structure
-Command mk_jobs_command() {
+Command mk_jobs_command(char** args) {
   Command cmd;
 
   cmd.jobs = (JobsCommand) {
-    JOBS
+    JOBS,
+    args
   };
 
   return cmd;
@@ -140,6 +205,116 @@ CommandType get_command_holder_type(CommandHolder holder) {
   return get_command_type(holder.cmd);
 }
 
+// Duplicate a string that may be NULL
+static char* __copy_str(const char* str) {
+  return (str != NULL) ? strdup(str) : NULL;
+}
+
+// Duplicate a NULL terminated array of strings
+static char** __copy_args(char** args) {
+  size_t n = 0;
+
+  while (args[n] != NULL)
+    ++n;
+
+  char** copy = malloc((n + 1) * sizeof(char*));
+
+  for (size_t i = 0; i <= n; ++i)
+    copy[i] = __copy_str(args[i]);
+
+  return copy;
+}
+
+static void __free_args(char** args) {
+  for (size_t i = 0; args[i] != NULL; ++i)
+    free(args[i]);
+
+  free(args);
+}
+
+// Copy a script out of the memory pool
+CommandHolder* copy_script(const CommandHolder* holders) {
+  size_t n = 0;
+
+  while (get_command_holder_type(holders[n]) != EOC)
+    ++n;
+
+  CommandHolder* copy = malloc((n + 1) * sizeof(CommandHolder));
+
+  memcpy(copy, holders, (n + 1) * sizeof(CommandHolder));
+
+  for (size_t i = 0; i < n; ++i) {
+    Command* cmd = &copy[i].cmd;
+
+    copy[i].redirect_in = __copy_str(holders[i].redirect_in);
+    copy[i].redirect_out = __copy_str(holders[i].redirect_out);
+
+    switch (get_command_type(*cmd)) {
+    case GENERIC:
+    case ECHO:
+    case JOBS:
+      cmd->generic.args = __copy_args(cmd->generic.args);
+      break;
+
+    case EXPORT:
+      cmd->export.env_var = __copy_str(cmd->export.env_var);
+      cmd->export.val = __copy_str(cmd->export.val);
+      break;
+
+    case CD:
+      cmd->cd.dir = __copy_str(cmd->cd.dir);
+      break;
+
+    case KILL:
+      cmd->kill.sig_str = __copy_str(cmd->kill.sig_str);
+      cmd->kill.job_str = __copy_str(cmd->kill.job_str);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return copy;
+}
+
+// Free a copied script
+void destroy_script_copy(CommandHolder* holders) {
+  for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i) {
+    Command cmd = holders[i].cmd;
+
+    free(holders[i].redirect_in);
+    free(holders[i].redirect_out);
+
+    switch (get_command_type(cmd)) {
+    case GENERIC:
+    case ECHO:
+    case JOBS:
+      __free_args(cmd.generic.args);
+      break;
+
+    case EXPORT:
+      free(cmd.export.env_var);
+      free(cmd.export.val);
+      break;
+
+    case CD:
+      free(cmd.cd.dir);
+      break;
+
+    case KILL:
+      free(cmd.kill.sig_str);
+      free(cmd.kill.job_str);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  free(holders);
+}
+
 #ifdef DEBUG
 static void __print_generic_cmd(GenericCommand cmd) {
   if (cmd.args != NULL) {
@@ -140,9 +140,11 @@ typedef struct CDCommand {
  */
 typedef struct KillCommand {
   CommandType type; /**< Type of command */
-  int sig;          /**< Signal to send to the job */
-  int job;          /**< Job id number */
-  char* sig_str;    /**< String holding the signal number (used for printing) */
+  int sig;          /**< Signal to send to the job or -1 if @a sig_str does
+                     * not name a signal */
+  int job;          /**< Job id number or -1 if @a job_str is not a job */
+  char* sig_str;    /**< String holding the signal as given or NULL if it was
+                     * left out (used for printing) */
   char* job_str;    /**< String holding the job id number (used for printing) */
 } KillCommand;
 
@@ -154,11 +156,13 @@ typedef struct KillCommand {
 typedef SimpleCommand PWDCommand;
 
 /**
- * @brief Alias for @a SimpleCommand to denote a print jobs list
+ * @brief Alias for @a GenericCommand to denote a print jobs list
  *
- * @sa SimpleCommand, Command, Job
+ * @note The arguments only hold the options given to jobs
+ *
+ * @sa GenericCommand, Command, Job
  */
-typedef SimpleCommand JobsCommand;
+typedef GenericCommand JobsCommand;
 
 /**
  * @brief Alias for @a SimpleCommand to denote a termination of the program
@@ -304,9 +308,10 @@ Command mk_cd_command(char* dir);
 /**
  * @brief Create a @a KillCommand structure and return a copy
  *
- * @param sig Signal to send to the job
+ * @param sig Signal to send to the job as a number or a name with an optional
+ * SIG prefix and leading '-'. NULL sends SIGTERM.
  *
- * @param job Job id number
+ * @param job Job id number with an optional leading '%'
  *
  * @return Copy of constructed KillCommand as a @a Command
  *
@@ -326,11 +331,14 @@ Command mk_pwd_command();
 /**
  * @brief Create a @a JobsCommand structure and return a copy
  *
+ * @param args A NULL terminated array of strings containing the options passed
+ * to jobs
+ *
  * @return Copy of constructed JobsCommand as a @a Command
  *
  * @sa Command, JobsCommand
  */
-Command mk_jobs_command();
+Command mk_jobs_command(char** args);
 
 /**
  * @brief Create a @a ExitCommand structure and return a copy
@@ -379,6 +387,28 @@ CommandType get_command_type(Command cmd);
  */
 CommandType get_command_holder_type(CommandHolder holder);
 
+/**
+ * @brief Copy a script so it can outlive the memory pool of the parser
+ *
+ * Every string in the copy is allocated separately with malloc().
+ *
+ * @param holders @a CommandHolder array ending with an EOC command
+ *
+ * @return The copy. Free it with destroy_script_copy().
+ *
+ * @sa destroy_script_copy
+ */
+CommandHolder* copy_script(const CommandHolder* holders);
+
+/**
+ * @brief Free a script made by copy_script()
+ *
+ * @param holders The copy to free
+ *
+ * @sa copy_script
+ */
+void destroy_script_copy(CommandHolder* holders);
+
 /**
  * @brief Print all commands in the script with @a print_command()
  *
@@ -7,12 +7,33 @@
  * @note As you add things to this file you may want to change the method signature
  */
 
+#define _GNU_SOURCE // for vmsplice
+
 #include "execute.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <fcntl.h> // for open
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include "job_table.h"
+#include "job_time.h"
+#include "jobserver.h"
+#include "memory_pool.h"
+#include "parallel.h"
+#include "path_cache.h"
+#include "placement.h"
+#include "pressure.h"
+#include "priority.h"
+#include "proc_stats.h"
 #include "quash.h"
+#include "resource_limits.h"
+#include "spawner.h"
 
 // Remove this and all expansion calls to it
 /**
@@ -24,20 +45,170 @@
 IMPLEMENT_DEQUE_STRUCT(PidDeque, pid_t);
 IMPLEMENT_DEQUE(PidDeque, pid_t);
 
-typedef struct Job {
-    int job_id;
-    char* cmd;
-    PidDeque pidDeque;
-} Job;
+IMPLEMENT_DEQUE_STRUCT(JobDeque, Job*);
+IMPLEMENT_DEQUE(JobDeque, Job*);
+
+/**
+ * @brief A builtin pipeline stage whose output is written by a thread
+ *
+ * The builtin itself runs in the quash process and its output is collected in
+ * @a buf. A thread then feeds the buffer to the next stage so quash does not
+ * block on a full pipe while it starts the rest of the pipeline.
+ */
+typedef struct BuiltinStage {
+  pthread_t thread; /**< Thread writing the output */
+  int fd;           /**< Descriptor the output is written to. Closed by the
+                     * thread when it is done. */
+  char* buf;        /**< Output of the builtin */
+  size_t len;       /**< Length of the output in bytes */
+} BuiltinStage;
+
+IMPLEMENT_DEQUE_STRUCT(StageDeque, BuiltinStage*);
+IMPLEMENT_DEQUE(StageDeque, BuiltinStage*);
+
+/**
+ * @brief Builtin stages of a job that was stopped before they finished
+ */
+typedef struct ParkedStages {
+  int job_id;         /**< Job the stages belong to */
+  StageDeque stages;  /**< Stages to join once the job is done */
+} ParkedStages;
+
+/**
+ * @def VMSPLICE_MIN
+ *
+ * @brief Outputs at least this large are mapped into a pipe with vmsplice()
+ * rather than copied into it with write()
+ */
+#define VMSPLICE_MIN (64 * 1024)
+
+/**
+ * @def THROTTLE_CHECK_MS
+ *
+ * @brief Milliseconds between pressure checks while quash waits and pressure
+ * thresholds are set
+ */
+#define THROTTLE_CHECK_MS 1000
+
+/**
+ * @def THROTTLE_SETTLE
+ *
+ * @brief Seconds to leave the pressure averages to catch up after a job was
+ * stopped or continued for pressure
+ */
+#define THROTTLE_SETTLE 10
+
+/**
+ * @brief The pipes connecting the stages of one job
+ *
+ * The pipe between stage i and stage i + 1 is only created when stage i is
+ * started and each end is closed in quash as soon as the stage using it has
+ * been started. Quash therefore holds at most three pipe descriptors for a
+ * pipeline no matter how many stages it has.
+ */
+typedef struct Pipeline {
+  int (*pipes)[2];  /**< Read and write end of each pipe. Closed ends are -1 */
+  size_t num_pipes; /**< Number of pipes (stages minus one) */
+  int pipe_size;    /**< Capacity to request for each pipe or 0 to keep the
+                     * system default */
+  pid_t pgid;       /**< Process group of the job or 0 until its first process
+                     * is created. Without job control the processes stay in
+                     * the group of quash and this is the first of them. */
+  JobTime* time;    /**< Usage of the job when it was run with the time prefix
+                     * or NULL */
+  const Placement* place; /**< CPUs and memory the processes of the job are
+                           * placed on or NULL to inherit those of quash */
+  const Priority* prio; /**< Scheduling of the processes of the job or NULL to
+                         * inherit that of quash */
+  const ResourceLimits* limits; /**< Limits of the job or NULL if neither the
+                                 * job nor the session sets any */
+} Pipeline;
 
-IMPLEMENT_DEQUE_STRUCT(JobDeque, Job);
-IMPLEMENT_DEQUE(JobDeque, Job);
+/**
+ * @brief Settings given to a job through the keywords in front of it
+ */
+typedef struct JobPrefixes {
+  Placement place;       /**< Placement given with on */
+  Priority prio;         /**< Priority given with nice */
+  ResourceLimits limits; /**< Limits given with ulimit */
+} JobPrefixes;
 
-//Declare queue of jobs
-static JobDeque jobs;
 static bool init = 1;
-static int pipes[2][2];
-static int job_id = 1;
+
+// Number of background jobs allowed to run at once. Zero until first needed.
+static size_t max_jobs = 0;
+
+// Spread background jobs without an explicit placement over the machine
+static bool spread_jobs = false;
+
+// Scheduling of background jobs without an explicit nice prefix and the name
+// it was chosen by
+static Priority background_prio = { 0, IO_CLASS_INHERIT, 0, false };
+static const char* background_prio_name = "off";
+
+// Background jobs started and not yet removed from the job table
+static size_t running_jobs = 0;
+
+// Background jobs waiting for a free job slot in the order they were queued
+static JobDeque pending_jobs;
+
+// Background jobs waiting for the jobs in their after list to finish
+static JobDeque blocked_jobs;
+
+// No job is stopped or continued for pressure before this time on the
+// monotonic clock
+static struct timespec next_throttle = { 0, 0 };
+
+// Builtin stages kept for stopped jobs
+static ParkedStages* parked_stages = NULL;
+static size_t num_parked_stages = 0;
+
+// The SIGCHLD handler writes a byte to this pipe for every child that exits,
+// stops or continues so the jobs only need to be examined when something
+// actually happened
+static int child_events[2] = { -1, -1 };
+
+// Stream output builtins print to. NULL means standard out.
+static FILE* builtin_out = NULL;
+
+// Get the stream output builtins should print to
+static FILE* builtin_stream() {
+  return (builtin_out != NULL) ? builtin_out : stdout;
+}
+
+// Prints a job line to a stream
+static void fprint_job(FILE* out, int job_id, pid_t pid, const char* cmd) {
+  fprintf(out, "[%d]\t%8d\t%s\n", job_id, pid, cmd);
+  fflush(out);
+}
+
+// Prints a job line for a job that is pending or stopped in place of its pid
+static void fprint_job_state(FILE* out, int job_id, const char* state,
+                             const char* cmd) {
+  fprintf(out, "[%d]\t%8s\t%s\n", job_id, state, cmd);
+  fflush(out);
+}
+
+// Send a signal to every process of a job. Returns false if no process got
+// it.
+static bool signal_job(Job* job, int sig) {
+  // With job control every stage shares one process group so they are all
+  // signalled at once. The group outlives its leader until the last member is
+  // reaped.
+  if (is_tty())
+    return kill(-job->pgid, sig) == 0;
+
+  // Otherwise the processes share the group of quash. Skip those that were
+  // already reaped, since their pid may belong to an unrelated process by now.
+  bool any = false;
+
+  for (size_t i = 0; i < job->num_pids; ++i)
+    if (job_table_find_pid(job->pids[i]) == job && kill(job->pids[i], sig) == 0)
+      any = true;
+
+  return any;
+}
+
 /***************************************************************************
  * Interface Functions
  ***************************************************************************/
@@ -60,45 +231,396 @@ const char* lookup_env(const char* env_var) {
   return getenv(env_var);
 }
 
+// Returns the value of the environment variable named by the first len
+// characters of name
+const char* lookup_env_len(const char* name, size_t len) {
+  for (char** env = environ; *env != NULL; ++env)
+    if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+      return *env + len + 1;
+
+  return NULL;
+}
+
+/***************************************************************************
+ * Child exit tracking
+ ***************************************************************************/
+
+// Note that a child changed state. Only async-signal-safe calls are allowed.
+static void sigchld_handler(int sig) {
+  int saved_errno = errno;
+  char c = 0;
+
+  // If the pipe is full a wake up is already pending
+  if (write(child_events[1], &c, 1) < 0) { }
+
+  errno = saved_errno;
+}
+
+// Create the child event pipe and install the SIGCHLD handler
+static void initialize_child_events() {
+  if (pipe2(child_events, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("ERROR: Failed to create child event pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = sigchld_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  sigaction(SIGCHLD, &sa, NULL);
+}
+
+// Empty the child event pipe. Returns true if any child changed state since the
+// last call.
+static bool drain_child_events() {
+  char buf[64];
+  bool any = false;
+
+  while (read(child_events[0], buf, sizeof(buf)) > 0)
+    any = true;
+
+  return any;
+}
+
+// Order jobs by job id
+static int compare_job_ids(const void* a, const void* b) {
+  return (*(Job* const*) a)->job_id - (*(Job* const*) b)->job_id;
+}
+
+static bool start_pending_jobs(bool below_prompt);
+static size_t job_limit();
+
+// Take a job out of a queue. Returns false if it was not there.
+static bool remove_queued_job(JobDeque* queue, Job* job) {
+  bool found = false;
+
+  for (size_t i = length_JobDeque(queue); i > 0; --i) {
+    Job* queued = pop_front_JobDeque(queue);
+
+    if (queued == job)
+      found = true;
+    else
+      push_back_JobDeque(queue, queued);
+  }
+
+  return found;
+}
+
+static void release_dependents(int job_id, bool failed);
+static void release_builtin_stages(int job_id);
+
+// Drop a job that never started and tell the jobs waiting on it
+static void cancel_pending_job(Job* job) {
+  int job_id = job->job_id;
+
+  if (!remove_queued_job(&pending_jobs, job))
+    remove_queued_job(&blocked_jobs, job);
+
+  printf("Cancelled: \t");
+  fprint_job_state(stdout, job->job_id, "Pending", job->cmd);
+
+  job_table_remove(job);
+  release_dependents(job_id, true);
+}
+
+// Strike a finished job off the after lists of blocked jobs. Jobs with nothing
+// left to wait on are queued to start. Jobs that may only start after a
+// success are cancelled when the finished job failed.
+static void release_dependents(int job_id, bool failed) {
+  // Jobs queued after this one is gone still go by how it ended
+  job_table_set_outcome(job_id, failed ? JOB_FAILED : JOB_SUCCEEDED);
+
+  size_t num_cancelled = 0;
+  Job* cancelled[length_JobDeque(&blocked_jobs) + 1];
+
+  for (size_t i = length_JobDeque(&blocked_jobs); i > 0; --i) {
+    Job* job = pop_front_JobDeque(&blocked_jobs);
+    bool waited = false;
+
+    for (uint32_t j = 0; j < job->num_after; ++j) {
+      if (job->after[j] == job_id) {
+        job->after[j] = job->after[--job->num_after];
+        waited = true;
+        break;
+      }
+    }
+
+    if (waited && failed && job->cancel_on_failure)
+      cancelled[num_cancelled++] = job;
+    else if (job->num_after == 0)
+      push_back_JobDeque(&pending_jobs, job);
+    else
+      push_back_JobDeque(&blocked_jobs, job);
+  }
+
+  // Cancelling a job counts as a failure for the jobs waiting on it in turn
+  for (size_t i = 0; i < num_cancelled; ++i)
+    cancel_pending_job(cancelled[i]);
+}
+
+// Jobs whose processes have all been reaped but that were not reported yet
+static Job** finished = NULL;
+static size_t finished_cap = 0;
+
+// Reap exited children. Returns the number of jobs that finished.
+static size_t reap_jobs() {
+  size_t num_finished = 0;
+  pid_t pid;
+  int status;
+
+  // Foreground processes are always waited on before this runs, so every
+  // child reaped here belongs to a job in the table
+  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+    // A process that stopped or continued is still alive
+    if (WIFSTOPPED(status) || WIFCONTINUED(status)) {
+      Job* job = job_table_find_pid(pid);
+
+      if (job != NULL)
+        job->stopped = WIFSTOPPED(status);
+
+      // Whoever continued a throttled job took it out of quash's hands
+      if (job != NULL && WIFCONTINUED(status))
+        job->throttled = false;
+
+      continue;
+    }
+
+    Job* job = job_table_reap(pid);
+
+    if (job == NULL)
+      continue;
+
+    // A pipeline succeeds or fails with its last stage
+    if (pid == job->pids[job->num_pids - 1])
+      job->status = status;
+
+    if (WIFSIGNALED(status) && is_limit_signal(WTERMSIG(status)))
+      job->limit_signal = WTERMSIG(status);
+
+    if (job->live > 0)
+      continue;
+
+    if (num_finished == finished_cap) {
+      finished_cap = (finished_cap == 0) ? 16 : 2 * finished_cap;
+      finished = realloc(finished, finished_cap * sizeof(Job*));
+    }
+
+    finished[num_finished++] = job;
+  }
+
+  return num_finished;
+}
+
+// Report and remove jobs that finished and start the jobs that were waiting
+// on them
+static void report_jobs(size_t num_finished) {
+  // Report and remove the finished jobs in job id order
+  qsort(finished, num_finished, sizeof(Job*), compare_job_ids);
+
+  for (size_t i = 0; i < num_finished; ++i) {
+    int job_id = finished[i]->job_id;
+    int job_status = finished[i]->status;
+
+    print_job_bg_complete(job_id, finished[i]->pids[0], finished[i]->cmd);
+
+    if (finished[i]->limit_signal != 0)
+      printf("\t%s\n", strsignal(finished[i]->limit_signal));
+
+    release_builtin_stages(job_id);
+    jobserver_release(finished[i]->token);
+    job_table_remove(finished[i]);
+
+    release_dependents(job_id, !WIFEXITED(job_status) ||
+                       WEXITSTATUS(job_status) != 0);
+  }
+
+  running_jobs -= num_finished;
+  start_pending_jobs(false);
+}
+
+/**
+ * @brief Act on the pressure thresholds
+ *
+ * While pressure is high the youngest running background job is stopped. Once
+ * it is low the oldest throttled job is continued, or queued jobs are started
+ * if none is throttled. After a job was stopped or continued nothing more is
+ * done until the pressure averages had time to follow.
+ *
+ * @param below_prompt Start any message on a new line when quash is at the
+ * prompt
+ *
+ * @return True if anything was printed
+ */
+static bool throttle_jobs(bool below_prompt) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (!pressure_throttling() || now.tv_sec < next_throttle.tv_sec)
+    return false;
+
+  PressureLevel level = check_pressure();
+  Job* pick = NULL;
+
+  for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id)) {
+    if (level == PRESSURE_HIGH && job->num_pids > 0 && job->live > 0 &&
+        !job->stopped && !job->throttled &&
+        (pick == NULL || job->started > pick->started))
+      pick = job;
+
+    if (level == PRESSURE_LOW && job->throttled &&
+        (pick == NULL || job->started < pick->started))
+      pick = job;
+  }
+
+  if (pick == NULL) {
+    bool startable = level != PRESSURE_HIGH && running_jobs < job_limit() &&
+      !is_empty_JobDeque(&pending_jobs);
+
+    return startable && start_pending_jobs(below_prompt);
+  }
+
+  if (below_prompt && is_tty())
+    putchar('\n');
+
+  if (level == PRESSURE_HIGH) {
+    pick->throttled = true;
+    signal_job(pick, SIGSTOP);
+    printf("Throttled: \t");
+  }
+  else {
+    pick->throttled = false;
+    pick->stopped = false;
+    signal_job(pick, SIGCONT);
+    printf("Resumed: \t");
+  }
+
+  print_job(pick->job_id, pick->pids[0], pick->cmd);
+
+  next_throttle = now;
+  next_throttle.tv_sec += THROTTLE_SETTLE;
+
+  return true;
+}
+
+// Continue every job stopped for pressure
+static void resume_throttled_jobs() {
+  for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id)) {
+    if (job->throttled) {
+      job->throttled = false;
+      job->stopped = false;
+      signal_job(job, SIGCONT);
+    }
+  }
+}
+
+// Give back the job slots of jobs still running when quash exits. Holding on
+// to them would take them from make for good.
+static void release_job_tokens() {
+  for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id)) {
+    jobserver_release(job->token);
+    job->token = JOBSERVER_NO_TOKEN;
+  }
+}
+
+// The jobserver descriptor to watch for a token. Only worth watching while a
+// queued job waits for nothing but a token.
+static int token_wait_fd() {
+  if (init || is_empty_JobDeque(&pending_jobs) || running_jobs >= job_limit() ||
+      check_pressure() == PRESSURE_HIGH)
+    return -1;
+
+  return jobserver_poll_fd();
+}
+
+// How long to wait for input or children before checking the pressure again
+static int throttle_timeout() {
+  if (!pressure_throttling() ||
+      (running_jobs == 0 && is_empty_JobDeque(&pending_jobs)))
+    return -1;
+
+  return THROTTLE_CHECK_MS;
+}
+
 // Check the status of background jobs
 void check_jobs_bg_status() {
-  // TODO: Check on the statuses of all processes belonging to all background
-  // jobs. This function should remove jobs from the jobs queue once all
-  // processes belonging to a job have completed.
-  int job_count = length_JobDeque(&jobs);
-  for(int i = 0; i< job_count; i++)
-  {
-	  Job job = pop_front_JobDeque(&jobs);
-	  pid_t process = peek_front_PidDeque(&job.pidDeque);
-	  int pid_count = length_PidDeque(&job.pidDeque);
-	  for(int j = 0; j < pid_count; j++)
-	  {
-		  pid_t pid = pop_front_PidDeque(&job.pidDeque);
-		  int status;
-		  if(waitpid(pid, &status, WNOHANG) == 0)
-		  {
-			  push_back_PidDeque(&job.pidDeque, pid);
-		  }
-	  }
-	  
-	  if(is_empty_PidDeque(&job.pidDeque))
-	  {
-		  print_job_bg_complete(job.job_id, process, job.cmd);
-		  free(job.cmd);
-		  destroy_PidDeque(&job.pidDeque);
-	  }
-	  else
-	  {
-		  push_back_JobDeque(&jobs, job);
-	  }
+  // Nothing to do unless a child exited since the last check
+  if (drain_child_events())
+    report_jobs(reap_jobs());
+
+  throttle_jobs(false);
+
+  // A token may have been given back by another client of the jobserver
+  start_pending_jobs(false);
+}
+
+// Waits for input while reporting background jobs that finish
+bool wait_for_input(int fd) {
+  struct pollfd fds[3] = {
+    { fd, POLLIN, 0 },
+    { child_events[0], POLLIN, 0 },
+    { -1, POLLIN, 0 }
+  };
+
+  while (true) {
+    fds[2].fd = token_wait_fd();
+
+    int ready = poll(fds, 3, throttle_timeout());
+
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+
+      // Let the read report the problem
+      return true;
+    }
+
+    // Pending input goes first so the output of a script does not depend on
+    // when its jobs happen to finish
+    if (fds[0].revents != 0)
+      return true;
+
+    // Pressure is checked whenever nothing happened for a while
+    if (ready == 0) {
+      if (!throttle_jobs(true))
+        continue;
+
+      fflush(stdout);
+      return false;
+    }
+
+    // Another client of the jobserver gave back a token
+    if (fds[2].revents != 0 && start_pending_jobs(true)) {
+      fflush(stdout);
+      return false;
+    }
+
+    if (fds[1].revents == 0 || !drain_child_events())
+      continue;
+
+    size_t num_finished = reap_jobs();
+
+    if (num_finished == 0)
+      continue;
+
+    // Start the report below the prompt the user is looking at
+    if (is_tty())
+      putchar('\n');
+
+    report_jobs(num_finished);
+    fflush(stdout);
+
+    return false;
   }
 }
 
 // Prints the job id number, the process id of the first process belonging to
 // the Job, and the command string associated with this job
 void print_job(int job_id, pid_t pid, const char* cmd) {
-  printf("[%d]\t%8d\t%s\n", job_id, pid, cmd);
-  fflush(stdout);
+  fprint_job(stdout, job_id, pid, cmd);
 }
 
 // Prints a start up message for background processes
@@ -125,8 +647,13 @@ void run_generic(GenericCommand cmd) {
   char* exec = cmd.args[0];
   char** args = cmd.args;
 
-  // TODO: Implement run generic
-  execvp(exec, args);
+  // The parent already searched PATH so this is a cache hit
+  const char* path = path_cache_lookup(exec);
+
+  if (path != NULL)
+    execv(path, args);
+  else
+    errno = ENOENT;
 
   perror("ERROR: Failed to execute program");
 }
@@ -142,11 +669,11 @@ void run_echo(EchoCommand cmd) {
 	{
 		if(str[i] == NULL)
 			break;
-		printf("%s ", str[i]);
+		fprintf(builtin_stream(), "%s ", str[i]);
 	}
-	printf("\n");
+	fprintf(builtin_stream(), "\n");
   // Flush the buffer before returning
-  fflush(stdout);
+  fflush(builtin_stream());
 }
 
 // Sets an environment variable
@@ -156,6 +683,9 @@ void run_export(ExportCommand cmd) {
   const char* val = cmd.val;
 
   setenv(env_var, val, 1);
+
+  if (strcmp(env_var, "PATH") == 0)
+    path_cache_clear();
 }
 
 // Changes the current working directory
@@ -180,212 +710,1884 @@ void run_cd(CDCommand cmd) {
 
 // Sends a signal to all processes contained in a job
 void run_kill(KillCommand cmd) {
-  int signal = cmd.sig;
-  int job_id = cmd.job;
-
- for(int i = 0; i < length_JobDeque(&jobs); i++)
- {
-	 Job job = pop_front_JobDeque(&jobs);
-	 if(job.job_id == job_id)
-	 {
-		 while(!is_empty_PidDeque(&job.pidDeque))
-		 {
-			 pid_t pid = pop_front_PidDeque(&job.pidDeque);
-			 kill(pid, signal);
-			 push_back_PidDeque(&job.pidDeque, pid);
-		 }
-	 }
-	 push_back_JobDeque(&jobs, job);
- }
+  if (cmd.sig < 0) {
+    fprintf(stderr, "kill: %s: invalid signal specification\n", cmd.sig_str);
+    return;
+  }
+
+  Job* job = job_table_find(cmd.job);
+
+  if (job == NULL) {
+    fprintf(stderr, "kill: %s: no such job\n", cmd.job_str);
+    return;
+  }
+
+  // A job that never started is cancelled by any real signal
+  if (job->num_pids == 0) {
+    if (cmd.sig != 0)
+      cancel_pending_job(job);
+
+    return;
+  }
+
+  if (job->live > 0 && !signal_job(job, cmd.sig))
+    perror("kill");
+
+  // A stopped process that handles the signal only sees it once it runs again
+  if (job->live > 0 && job->stopped && cmd.sig != 0 && cmd.sig != SIGSTOP &&
+      cmd.sig != SIGTSTP)
+    signal_job(job, SIGCONT);
 }
 
 
 // Prints the current working directory to stdout
 void run_pwd() {
   // TODO: Print the current working directory
-	printf("%s\n", lookup_env("PWD"));
+	fprintf(builtin_stream(), "%s\n", lookup_env("PWD"));
   // Flush the buffer before returning
-	fflush(stdout);
+	fflush(builtin_stream());
 }
 
-// Prints all background jobs currently in the job list to stdout
-void run_jobs() {
-  // TODO: Print background jobs
-  for(int i = 0; i < length_JobDeque(&jobs); i++)
-  {
-	  Job job = pop_front_JobDeque(&jobs);
-	  print_job(job.job_id, peek_front_PidDeque(&job.pidDeque), job.cmd);
-	  push_back_JobDeque(&jobs, job);
+// Milliseconds left until a deadline on the monotonic clock
+static int ms_until(struct timespec deadline) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long ms = (deadline.tv_sec - now.tv_sec) * 1000LL +
+    (deadline.tv_nsec - now.tv_nsec) / 1000000;
+
+  return (ms < 0) ? 0 : (ms > 0x7fffffff) ? 0x7fffffff : (int) ms;
+}
+
+// Format a byte count with a binary unit
+static void format_bytes(char* buf, size_t size, unsigned long long bytes) {
+  static const char units[] = "BKMGTP";
+  double value = bytes;
+  int unit = 0;
+
+  while (value >= 1024 && units[unit + 1] != '\0') {
+    value /= 1024;
+    ++unit;
   }
 
-  // Flush the buffer before returning
-  fflush(stdout);
+  if (unit == 0)
+    snprintf(buf, size, "%lluB", bytes);
+  else
+    snprintf(buf, size, "%.1f%c", value, units[unit]);
 }
 
-/***************************************************************************
- * Functions for command resolution and process setup
- ***************************************************************************/
+// Prints a row of the usage table
+static void fprint_stats(FILE* out, const char* label, pid_t pid,
+                         const ProcStats* stats, const char* cmd) {
+  char rss[16], read_bytes[16], write_bytes[16];
 
-/**
- * @brief A dispatch function to resolve the correct @a Command variant
- * function for child processes.
- *
- * This version of the function is tailored to commands that should be run in
- * the child process of a fork.
- *
- * @param cmd The Command to try to run
- *
- * @sa Command
- */
-void child_run_command(Command cmd) {
-  CommandType type = get_command_type(cmd);
+  format_bytes(rss, sizeof(rss), stats->rss);
+  format_bytes(read_bytes, sizeof(read_bytes), stats->read_bytes);
+  format_bytes(write_bytes, sizeof(write_bytes), stats->write_bytes);
 
-  switch (type) {
-  case GENERIC:
-    run_generic(cmd.generic);
-    break;
+  fprintf(out, "%s\t%8d\t%c\t%5.1f%%\t%8s\t%8s\t%8s\t%s\n", label, pid,
+          stats->state, stats->cpu, rss, read_bytes, write_bytes, cmd);
+}
 
-  case ECHO:
-    run_echo(cmd.echo);
-    break;
+// Prints the usage of every job summed over its processes, and of each
+// process as well in the long format
+static void fprint_job_stats(FILE* out, bool long_format) {
+  fprintf(out, "JOB\t%8s\tS\t%6s\t%8s\t%8s\t%8s\tCOMMAND\n", "PID", "CPU",
+          "RSS", "READ", "WRITE");
 
-  case PWD:
-    run_pwd();
-    break;
+  proc_stats_begin_round();
 
-  case JOBS:
-    run_jobs();
-    break;
+  for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id)) {
+    if (job->num_pids == 0) {
+      fprint_job_state(out, job->job_id, "Pending", job->cmd);
+      continue;
+    }
 
-  case EXPORT:
-  case CD:
-  case KILL:
-  case EXIT:
-  case EOC:
-    break;
+    ProcStats total = new_proc_stats();
+    ProcStats stats[job->num_pids];
+    bool sampled[job->num_pids];
+    char label[16];
 
-  default:
-    fprintf(stderr, "Unknown command type: %d\n", type);
+    // Processes that were already reaped have nothing left to sample
+    for (size_t k = 0; k < job->num_pids; ++k) {
+      sampled[k] = job_table_find_pid(job->pids[k]) == job &&
+        proc_stats_sample(job->pids[k], &stats[k]);
+
+      if (sampled[k])
+        proc_stats_add(&total, &stats[k]);
+    }
+
+    snprintf(label, sizeof(label), "[%d]", job->job_id);
+    fprint_stats(out, label, job->pids[0], &total, job->cmd);
+
+    for (size_t k = 0; long_format && k < job->num_pids; ++k)
+      if (sampled[k])
+        fprint_stats(out, "", job->pids[k], &stats[k], "");
   }
+
+  // Files of processes that are gone are closed here
+  proc_stats_end_round();
+
+  fflush(out);
 }
 
-/**
- * @brief A dispatch function to resolve the correct @a Command variant
- * function for the quash process.
- *
- * This version of the function is tailored to commands that should be run in
- * the parent process (quash).
- *
- * @param cmd The Command to try to run
+// Redraws the usage of the jobs every second until a line is entered or no job
+// is left
+static void top_jobs(bool long_format) {
+  struct pollfd fds[2] = {
+    { STDIN_FILENO, POLLIN, 0 },
+    { child_events[0], POLLIN, 0 }
+  };
+
+  while (true) {
+    // Jobs that finished are reported and the jobs waiting on them started as
+    // usual, right before the screen is cleared
+    check_jobs_bg_status();
+
+    printf("\033[H\033[2J");
+    fprint_job_stats(stdout, long_format);
+
+    if (job_table_next(0) == NULL)
+      return;
+
+    printf("\nPress Enter to stop\n");
+    fflush(stdout);
+
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    ++deadline.tv_sec;
+
+    int ms;
+
+    while ((ms = ms_until(deadline)) > 0) {
+      if (poll(fds, 2, ms) < 0 && errno != EINTR)
+        return;
+
+      if (fds[0].revents != 0) {
+        // The terminal is in canonical mode, so reads return at most one
+        // line and the line is complete once a read ends with a newline
+        char line[256];
+        ssize_t n;
+
+        while ((n = read(STDIN_FILENO, line, sizeof(line))) > 0 ?
+               line[n - 1] != '\n' : (n < 0 && errno == EINTR))
+          ;
+
+        return;
+      }
+
+      // Redraw right away when a job changed state
+      if (fds[1].revents != 0)
+        break;
+    }
+  }
+}
+
+// Prints all background jobs currently in the job list to stdout
+void run_jobs(JobsCommand cmd) {
+  FILE* out = builtin_stream();
+  bool long_format = false;
+  bool stats = false;
+  bool top = false;
+
+  for (size_t i = 0; cmd.args[i] != NULL; ++i) {
+    if (strcmp(cmd.args[i], "-l") == 0) {
+      long_format = true;
+    }
+    else if (strcmp(cmd.args[i], "--stats") == 0) {
+      stats = true;
+    }
+    else if (strcmp(cmd.args[i], "--top") == 0) {
+      top = true;
+    }
+    else {
+      fprintf(stderr, "jobs: usage: jobs [-l] [--stats | --top]\n");
+      return;
+    }
+  }
+
+  // Redrawing only makes sense on a terminal the user is typing at
+  if (top && builtin_out == NULL && is_tty() && isatty(STDOUT_FILENO)) {
+    top_jobs(long_format);
+    destroy_proc_stats();
+    return;
+  }
+
+  // Only the redraws of --top reuse the open files
+  if (stats || top) {
+    fprint_job_stats(out, long_format);
+    destroy_proc_stats();
+    return;
+  }
+
+  for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id)) {
+    if (job->num_pids == 0)
+      fprint_job_state(out, job->job_id, "Pending", job->cmd);
+    else if (job->throttled)
+      fprint_job_state(out, job->job_id, "Throttled", job->cmd);
+    else if (job->stopped)
+      fprint_job_state(out, job->job_id, "Stopped", job->cmd);
+    else
+      fprint_job(out, job->job_id, job->pids[0], job->cmd);
+
+    if (!long_format || job->num_pids == 0)
+      continue;
+
+    // Every process of the job followed by why a process was killed if it ran
+    // into a resource limit
+    fprintf(out, "\tpids:");
+
+    for (size_t k = 0; k < job->num_pids; ++k)
+      fprintf(out, " %d", job->pids[k]);
+
+    fprintf(out, "\n");
+
+    if (job->limit_signal != 0)
+      fprintf(out, "\tlimit:\t%s\n", strsignal(job->limit_signal));
+  }
+
+  // Flush the buffer before returning
+  fflush(builtin_stream());
+}
+
+// Inspects, primes, or clears the executable location cache
+void run_hash(char** args) {
+  if (args[1] == NULL) {
+    path_cache_print(builtin_stream());
+  }
+  else if (strcmp(args[1], "-r") == 0) {
+    path_cache_clear();
+  }
+  else {
+    for (int i = 1; args[i] != NULL; ++i)
+      if (!path_cache_prime(args[i]))
+        fprintf(stderr, "hash: %s: not found\n", args[i]);
+  }
+
+  fflush(builtin_stream());
+}
+
+// Sets or prints the session limits
+static void run_ulimit_builtin(char** args) {
+  run_ulimit(args, builtin_stream());
+}
+
+// Waits for background jobs to finish
+void run_wait(char** args) {
+  bool any = false;
+  double timeout = -1;
+  int i = 1;
+
+  for (; args[i] != NULL && args[i][0] == '-'; ++i) {
+    char* end = NULL;
+
+    if (strcmp(args[i], "-n") == 0)
+      any = true;
+    else if (strcmp(args[i], "-t") == 0 && args[i + 1] != NULL &&
+             (timeout = strtod(args[i + 1], &end)) >= 0 && *end == '\0')
+      ++i;
+    else {
+      fprintf(stderr, "wait: usage: wait [-n] [-t seconds] [%%job ...]\n");
+      return;
+    }
+  }
+
+  // Collect the jobs to wait on. No job specs means every job.
+  size_t num_ids = 0;
+  int* ids;
+
+  if (args[i] == NULL) {
+    for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id))
+      ++num_ids;
+
+    ids = malloc((num_ids + 1) * sizeof(int));
+    num_ids = 0;
+
+    for (Job* job = job_table_next(0); job != NULL; job = job_table_next(job->job_id))
+      ids[num_ids++] = job->job_id;
+  }
+  else {
+    ids = malloc(sizeof(int));
+
+    for (; args[i] != NULL; ++i) {
+      char* end;
+      long id = strtol(args[i] + (args[i][0] == '%'), &end, 10);
+
+      if (*end != '\0' || job_table_find(id) == NULL) {
+        fprintf(stderr, "wait: %s: no such job\n", args[i]);
+        continue;
+      }
+
+      ids = realloc(ids, (num_ids + 1) * sizeof(int));
+      ids[num_ids++] = id;
+    }
+  }
+
+  // Watch every unreaped process of the selected jobs. Without process
+  // descriptors fall back to the SIGCHLD pipe, which wakes up for any child.
+  size_t num_fds = 0;
+  bool fallback = false;
+
+  for (size_t j = 0; j < num_ids; ++j)
+    num_fds += job_table_find(ids[j])->live;
+
+  struct pollfd* fds = malloc((num_fds + 2) * sizeof(struct pollfd));
+
+  num_fds = 0;
+
+  for (size_t j = 0; j < num_ids; ++j) {
+    Job* job = job_table_find(ids[j]);
+
+    // A pending job has no processes to watch until it starts
+    if (job->num_pids == 0)
+      fallback = true;
+
+    for (size_t k = 0; k < job->num_pids; ++k) {
+      if (job_table_find_pid(job->pids[k]) != job)
+        continue;
+
+      int fd = open_pidfd(job->pids[k]);
+
+      if (fd >= 0)
+        fds[num_fds++] = (struct pollfd) { fd, POLLIN, 0 };
+      else
+        fallback = true;
+    }
+  }
+
+  if (fallback)
+    fds[num_fds++] = (struct pollfd) { child_events[0], POLLIN, 0 };
+
+  // The last entry watches the jobserver while queued jobs wait for a token
+  size_t token_fd = num_fds++;
+
+  struct timespec deadline;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += (time_t) timeout;
+  deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+
+  if (deadline.tv_nsec >= 1000000000L) {
+    ++deadline.tv_sec;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  while (true) {
+    // Reaping reports and removes finished jobs as usual
+    check_jobs_bg_status();
+
+    size_t done = 0;
+
+    for (size_t j = 0; j < num_ids; ++j)
+      if (job_table_find(ids[j]) == NULL)
+        ++done;
+
+    if (done == num_ids || (any && done > 0))
+      break;
+
+    int ms = (timeout < 0) ? -1 : ms_until(deadline);
+
+    // Wake up in time to check the pressure again
+    int check = throttle_timeout();
+
+    if (check >= 0 && (ms < 0 || ms > check))
+      ms = check;
+
+    fds[token_fd] = (struct pollfd) { token_wait_fd(), POLLIN, 0 };
+
+    if (ms == 0 || (poll(fds, num_fds, ms) < 0 && errno != EINTR))
+      break;
+
+    // An exited process stays readable, so stop watching it
+    for (size_t j = 0; j < token_fd; ++j) {
+      if (fds[j].fd != child_events[0] && (fds[j].revents & POLLIN)) {
+        close(fds[j].fd);
+        fds[j].fd = -1;
+      }
+    }
+  }
+
+  for (size_t j = 0; j < token_fd; ++j)
+    if (fds[j].fd >= 0 && fds[j].fd != child_events[0])
+      close(fds[j].fd);
+
+  free(fds);
+  free(ids);
+}
+
+// The number of background jobs allowed to run at once
+static size_t job_limit() {
+  if (max_jobs == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // With a single CPU the default would run every background job one at a
+    // time, so always allow at least two
+    max_jobs = (cpus > 2) ? cpus : 2;
+  }
+
+  return max_jobs;
+}
+
+// Print the maxjobs option
+static void print_max_jobs(FILE* out) {
+  fprintf(out, "maxjobs\t%zu\n", job_limit());
+}
+
+// Set the maxjobs option. Returns false if the value is invalid.
+static bool set_max_jobs(const char* value) {
+  char* end;
+  long limit = strtol(value, &end, 10);
+
+  if (*end != '\0' || limit < 1)
+    return false;
+
+  max_jobs = limit;
+
+  // A larger limit frees job slots right away
+  start_pending_jobs(false);
+
+  return true;
+}
+
+// Print the spread option
+static void print_spread(FILE* out) {
+  fprintf(out, "spread\t%s\n", spread_jobs ? "on" : "off");
+}
+
+// Set the spread option. Returns false if the value is invalid.
+static bool set_spread(const char* value) {
+  if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)
+    return false;
+
+  spread_jobs = strcmp(value, "on") == 0;
+
+  return true;
+}
+
+// Print the bgprio option
+static void print_background_prio(FILE* out) {
+  fprintf(out, "bgprio\t%s\n", background_prio_name);
+}
+
+// Set the bgprio option. Returns false if the value is invalid.
+static bool set_background_prio(const char* value) {
+  static const char* names[] = { "off", "nice", "idle", "batch", NULL };
+
+  for (size_t i = 0; names[i] != NULL; ++i) {
+    if (strcmp(value, names[i]) == 0) {
+      parse_priority_preset(&background_prio, names[i]);
+      background_prio_name = names[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Print a pressure threshold option
+static void print_cpu_pressure(FILE* out) {
+  print_pressure_threshold(out, PRESSURE_CPU);
+}
+
+static void print_memory_pressure(FILE* out) {
+  print_pressure_threshold(out, PRESSURE_MEMORY);
+}
+
+static void print_io_pressure(FILE* out) {
+  print_pressure_threshold(out, PRESSURE_IO);
+}
+
+// Set a pressure threshold option. Returns false if the value is invalid.
+static bool set_pressure(PressureResource res, const char* value) {
+  if (!set_pressure_threshold(res, value))
+    return false;
+
+  // Without thresholds nothing would ever continue the throttled jobs
+  if (!pressure_throttling()) {
+    resume_throttled_jobs();
+    start_pending_jobs(false);
+  }
+
+  return true;
+}
+
+static bool set_cpu_pressure(const char* value) {
+  return set_pressure(PRESSURE_CPU, value);
+}
+
+static bool set_memory_pressure(const char* value) {
+  return set_pressure(PRESSURE_MEMORY, value);
+}
+
+static bool set_io_pressure(const char* value) {
+  return set_pressure(PRESSURE_IO, value);
+}
+
+/**
+ * @brief An option of the set builtin
+ */
+typedef struct ShellOption {
+  const char* name;                /**< Name given to set -o */
+  void (*print)(FILE* out);        /**< Print the name and current value */
+  bool (*set)(const char* value);  /**< Change the value. Returns false if the
+                                    * value is invalid. */
+} ShellOption;
+
+static const ShellOption shell_options[] = {
+  { "bgprio", print_background_prio, set_background_prio },
+  { "cpupressure", print_cpu_pressure, set_cpu_pressure },
+  { "iopressure", print_io_pressure, set_io_pressure },
+  { "jobserver", print_jobserver, set_jobserver },
+  { "maxjobs", print_max_jobs, set_max_jobs },
+  { "mempressure", print_memory_pressure, set_memory_pressure },
+  { "spread", print_spread, set_spread },
+  { NULL, NULL, NULL }
+};
+
+// Sets shell options
+void run_set(char** args) {
+  if (args[1] == NULL || strcmp(args[1], "-o") != 0 ||
+      (args[2] != NULL && args[3] != NULL && args[4] != NULL)) {
+    fprintf(stderr, "set: usage: set -o [option [value]]\n");
+    return;
+  }
+
+  FILE* out = builtin_stream();
+  bool found = false;
+
+  for (const ShellOption* opt = shell_options; opt->name != NULL; ++opt) {
+    if (args[2] != NULL && strcmp(args[2], opt->name) != 0)
+      continue;
+
+    found = true;
+
+    if (args[2] == NULL || args[3] == NULL)
+      opt->print(out);
+    else if (!opt->set(args[3]))
+      fprintf(stderr, "set: %s: invalid value for %s\n", args[3], opt->name);
+  }
+
+  if (!found)
+    fprintf(stderr, "set: %s: invalid option name\n", args[2]);
+
+  fflush(out);
+}
+
+/***************************************************************************
+ * Functions for command resolution and process setup
+ ***************************************************************************/
+
+/**
+ * @brief A builtin that the parser reports as a @a GenericCommand
+ *
+ * These builtins are recognized by the name in the first argument. Most of
+ * them change the state of quash and always run in the quash process.
+ */
+typedef struct NamedBuiltin {
+  const char* name;        /**< Name the builtin is invoked with */
+  void (*run)(char** args); /**< Function implementing the builtin */
+  bool own_process;        /**< Always runs in a child of quash that is a job
+                            * of its own, like a program would. Such builtins
+                            * may read standard in and start processes. */
+} NamedBuiltin;
+
+static const NamedBuiltin named_builtins[] = {
+  { "bg", run_bg, false },
+  { "fg", run_fg, false },
+  { "hash", run_hash, false },
+  { "parallel", run_parallel, true },
+  { "set", run_set, false },
+  { "ulimit", run_ulimit_builtin, false },
+  { "wait", run_wait, false },
+  { NULL, NULL, false }
+};
+
+// Find the named builtin a generic command refers to. Returns NULL for
+// commands that should be run as programs.
+static const NamedBuiltin* find_named_builtin(Command cmd) {
+  if (get_command_type(cmd) != GENERIC)
+    return NULL;
+
+  for (int i = 0; named_builtins[i].name != NULL; ++i)
+    if (strcmp(cmd.generic.args[0], named_builtins[i].name) == 0)
+      return &named_builtins[i];
+
+  return NULL;
+}
+
+/**
+ * @brief A dispatch function to resolve the correct @a Command variant
+ * function for child processes.
+ *
+ * This version of the function is tailored to commands that should be run in
+ * the child process of a fork.
+ *
+ * @param cmd The Command to try to run
+ *
+ * @sa Command
+ */
+void child_run_command(Command cmd) {
+  CommandType type = get_command_type(cmd);
+
+  switch (type) {
+  case GENERIC: {
+    const NamedBuiltin* builtin = find_named_builtin(cmd);
+
+    if (builtin == NULL)
+      run_generic(cmd.generic);
+    else if (builtin->own_process)
+      builtin->run(cmd.generic.args);
+    break;
+  }
+
+  case ECHO:
+    run_echo(cmd.echo);
+    break;
+
+  case PWD:
+    run_pwd();
+    break;
+
+  case JOBS:
+    run_jobs(cmd.jobs);
+    break;
+
+  case EXPORT:
+  case CD:
+  case KILL:
+  case EXIT:
+  case EOC:
+    break;
+
+  default:
+    fprintf(stderr, "Unknown command type: %d\n", type);
+  }
+}
+
+/**
+ * @brief A dispatch function to resolve the correct @a Command variant
+ * function for the quash process.
+ *
+ * This version of the function is tailored to commands that should be run in
+ * the parent process (quash).
+ *
+ * @param cmd The Command to try to run
+ *
+ * @sa Command
+ */
+void parent_run_command(Command cmd) {
+  CommandType type = get_command_type(cmd);
+
+  switch (type) {
+  case EXPORT:
+    run_export(cmd.export);
+    break;
+
+  case CD:
+    run_cd(cmd.cd);
+    break;
+
+  case KILL:
+    run_kill(cmd.kill);
+    break;
+
+  case GENERIC: {
+    const NamedBuiltin* builtin = find_named_builtin(cmd);
+
+    if (builtin != NULL && !builtin->own_process)
+      builtin->run(cmd.generic.args);
+    break;
+  }
+
+  case ECHO:
+  case PWD:
+  case JOBS:
+  case EXIT:
+  case EOC:
+    break;
+
+  default:
+    fprintf(stderr, "Unknown command type: %d\n", type);
+  }
+}
+
+// Check if a command is implemented inside of quash
+static bool is_builtin(Command cmd) {
+  return get_command_type(cmd) != GENERIC || find_named_builtin(cmd) != NULL;
+}
+
+// Point a standard stream at a file for a builtin run in the quash
+// process. Returns a duplicate of the original descriptor or -1 on failure.
+static int redirect_std_stream(int std_fd, const char* file, int flags) {
+  int fd = open(file, flags, 0666);
+
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: Failed to open %s: %s\n", file, strerror(errno));
+    return -1;
+  }
+
+  // Processes the builtin starts must not inherit the saved stream
+  int saved = fcntl(std_fd, F_DUPFD_CLOEXEC, 0);
+
+  dup2(fd, std_fd);
+  close(fd);
+
+  return saved;
+}
+
+// Put back a standard stream saved by redirect_std_stream()
+static void restore_std_stream(int std_fd, int saved) {
+  if (saved < 0)
+    return;
+
+  dup2(saved, std_fd);
+  close(saved);
+}
+
+/**
+ * @brief Run a builtin that is not part of a pipeline in the quash process
+ *
+ * Redirects are applied by temporarily replacing the standard streams of quash
+ * so no process has to be created.
+ *
+ * @param holder The CommandHolder to run
+ */
+static void run_builtin_in_place(CommandHolder holder) {
+  int saved_in = -1;
+  int saved_out = -1;
+
+  if (holder.flags & REDIRECT_IN) {
+    if ((saved_in = redirect_std_stream(STDIN_FILENO, holder.redirect_in,
+                                        O_RDONLY)) < 0)
+      return;
+  }
+
+  if (holder.flags & REDIRECT_OUT) {
+    int flags = O_WRONLY | O_CREAT |
+      ((holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC);
+
+    fflush(stdout);
+
+    if ((saved_out = redirect_std_stream(STDOUT_FILENO, holder.redirect_out,
+                                         flags)) < 0) {
+      restore_std_stream(STDIN_FILENO, saved_in);
+      return;
+    }
+  }
+
+  child_run_command(holder.cmd);
+  parent_run_command(holder.cmd);
+
+  fflush(stdout);
+
+  restore_std_stream(STDOUT_FILENO, saved_out);
+  restore_std_stream(STDIN_FILENO, saved_in);
+}
+
+static void add_stage_process(CommandHolder holder, Pipeline* pl, pid_t pid,
+                              PidDeque* pidDeque);
+
+// Thread body for a BuiltinStage. Large outputs are spliced into pipes
+// without a copy. The buffer is only released after every process of the job
+// has exited, so pages handed to the pipe are never reused while a reader can
+// still see them.
+static void* write_stage_output(void* arg) {
+  BuiltinStage* stage = arg;
+  bool splice = stage->len >= VMSPLICE_MIN;
+  size_t off = 0;
+
+  while (off < stage->len) {
+    ssize_t n;
+
+    if (splice) {
+      struct iovec iov = { stage->buf + off, stage->len - off };
+
+      if ((n = vmsplice(stage->fd, &iov, 1, 0)) < 0 && errno == EBADF) {
+        // Not a pipe. Fall back to copying.
+        splice = false;
+        continue;
+      }
+    }
+    else {
+      n = write(stage->fd, stage->buf + off, stage->len - off);
+    }
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      break;                  // The reader went away
+    }
+
+    off += n;
+  }
+
+  close(stage->fd);
+
+  return NULL;
+}
+
+// Close a descriptor if it is open and mark it closed
+static void close_fd(int* fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+// Set up the pipe bookkeeping for a script. The capacity of every pipe can be
+// tuned with the QUASH_PIPE_SIZE environment variable.
+static Pipeline new_pipeline(const CommandHolder* holders) {
+  size_t stages = 0;
+
+  while (get_command_holder_type(holders[stages]) != EOC)
+    ++stages;
+
+  Pipeline pl;
+  const char* size = lookup_env("QUASH_PIPE_SIZE");
+
+  pl.num_pipes = (stages > 0) ? stages - 1 : 0;
+  pl.pipes = malloc((pl.num_pipes + 1) * sizeof(int[2]));
+  pl.pipe_size = (size != NULL) ? strtol(size, NULL, 10) : 0;
+  pl.pgid = 0;
+  pl.time = NULL;
+  pl.place = NULL;
+  pl.prio = NULL;
+  pl.limits = NULL;
+
+  for (size_t i = 0; i < pl.num_pipes; ++i)
+    pl.pipes[i][0] = pl.pipes[i][1] = -1;
+
+  return pl;
+}
+
+// Create the pipe that carries the output of stage i. Returns the write end.
+static int open_pipe(Pipeline* pl, size_t i) {
+  assert(i < pl->num_pipes);
+
+  if (pipe2(pl->pipes[i], O_CLOEXEC) != 0) {
+    perror("ERROR: Failed to create pipe");
+    return -1;
+  }
+
+  // The kernel rounds the size up to a power of two number of pages and
+  // refuses sizes above /proc/sys/fs/pipe-max-size. Either way the pipe still
+  // works so a failure is not an error.
+  if (pl->pipe_size > 0)
+    fcntl(pl->pipes[i][1], F_SETPIPE_SZ, pl->pipe_size);
+
+  return pl->pipes[i][1];
+}
+
+// Close every pipe end still held
+static void close_pipeline(Pipeline* pl) {
+  for (size_t i = 0; i < pl->num_pipes; ++i) {
+    close_fd(&pl->pipes[i][0]);
+    close_fd(&pl->pipes[i][1]);
+  }
+}
+
+static void destroy_pipeline(Pipeline* pl) {
+  close_pipeline(pl);
+  free(pl->pipes);
+  pl->pipes = NULL;
+}
+
+/**
+ * @brief Run a builtin pipeline stage without creating a process
+ *
+ * The builtin runs in the quash process with its output collected in memory
+ * and a thread writes that output to the next pipe, the redirect file or
+ * standard out. Builtins do not read standard in, so an incoming pipe is
+ * closed right away.
+ *
+ * @param holder The CommandHolder to run
+ *
+ * @param in_fd Read end of the incoming pipe or -1
+ *
+ * @param out_fd Write end of the outgoing pipe or -1. Ownership passes to the
+ * stage.
+ *
+ * @param pl The pipes of the job the stage belongs to
+ *
+ * @param pidDeque If no thread can be created the output is written by a new
+ * process of the job instead, which is added here
+ *
+ * @param stages The stage is added here so it can be joined when the job is
+ * done
+ */
+static void start_builtin_stage(CommandHolder holder, int in_fd, int out_fd,
+                                Pipeline* pl, PidDeque* pidDeque,
+                                StageDeque* stages) {
+  if (in_fd >= 0)
+    close(in_fd);
+
+  if (out_fd < 0 && (holder.flags & REDIRECT_OUT)) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+      ((holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC);
+
+    if ((out_fd = open(holder.redirect_out, flags, 0666)) < 0)
+      fprintf(stderr, "ERROR: Failed to open %s: %s\n", holder.redirect_out,
+              strerror(errno));
+  }
+  else if (out_fd < 0) {
+    fflush(stdout);
+    out_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  }
+  else {
+    // Keep processes created later in the pipeline from holding the write end
+    // open after the thread closes it
+    fcntl(out_fd, F_SETFD, FD_CLOEXEC);
+  }
+
+  BuiltinStage* stage = malloc(sizeof(BuiltinStage));
+  FILE* mem;
+
+  stage->fd = out_fd;
+  stage->buf = NULL;
+  stage->len = 0;
+
+  if ((mem = open_memstream(&stage->buf, &stage->len)) != NULL) {
+    builtin_out = mem;
+    child_run_command(holder.cmd);
+    parent_run_command(holder.cmd);
+    builtin_out = NULL;
+
+    fclose(mem);
+  }
+
+  if (out_fd < 0) {
+    free(stage->buf);
+    free(stage);
+    return;
+  }
+
+  // The thread must not take signals meant for quash and a closed pipe should
+  // show up as EPIPE rather than SIGPIPE
+  sigset_t all, old;
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  if (pthread_create(&stage->thread, NULL, write_stage_output, stage) == 0) {
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    push_back_StageDeque(stages, stage);
+    return;
+  }
+
+  // Writing here could block on a full pipe before the stages reading it
+  // exist, so a process of the job writes the output instead
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    if (is_tty())
+      setpgid(0, pl->pgid);
+
+    // The read end of the pipe must only be held by the next stage, or the
+    // write never fails once that stage is gone
+    close_pipeline(pl);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    write_stage_output(stage);
+    _exit(EXIT_SUCCESS);
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (pid < 0)
+    perror("ERROR: Failed to create process");
+  else
+    add_stage_process(holder, pl, pid, pidDeque);
+
+  close(out_fd);
+  free(stage->buf);
+  free(stage);
+}
+
+// Wait for the threads of builtin stages and free their output
+static void join_builtin_stages(StageDeque* stages) {
+  while (!is_empty_StageDeque(stages)) {
+    BuiltinStage* stage = pop_front_StageDeque(stages);
+
+    pthread_join(stage->thread, NULL);
+
+    free(stage->buf);
+    free(stage);
+  }
+}
+
+// Keep the builtin stages of a stopped job. Their threads may still be
+// writing to a stage that is stopped, and spliced pages must outlive every
+// process of the job.
+static void park_builtin_stages(int job_id, StageDeque* stages) {
+  if (is_empty_StageDeque(stages))
+    return;
+
+  parked_stages = realloc(parked_stages,
+                          (num_parked_stages + 1) * sizeof(ParkedStages));
+  parked_stages[num_parked_stages++] = (ParkedStages) { job_id, *stages };
+
+  *stages = new_StageDeque(1);
+}
+
+// Join the builtin stages kept for a job whose processes have all exited
+static void release_builtin_stages(int job_id) {
+  for (size_t i = 0; i < num_parked_stages; ++i) {
+    if (parked_stages[i].job_id == job_id) {
+      join_builtin_stages(&parked_stages[i].stages);
+      destroy_StageDeque(&parked_stages[i].stages);
+
+      parked_stages[i] = parked_stages[--num_parked_stages];
+      return;
+    }
+  }
+}
+
+// The process group to spawn a process of a job in. Jobs only get groups of
+// their own with job control, as quash is then the only one that decides which
+// of them owns the terminal. Otherwise Ctrl-C has to reach the job and quash
+// alike.
+static pid_t job_group(const Pipeline* pl) {
+  return is_tty() ? pl->pgid : -1;
+}
+
+// Make a process group the foreground group of the terminal. SIGTTOU is
+// blocked because quash may be asking from a background group.
+static void set_terminal_owner(pid_t pgid) {
+  sigset_t ttou, old;
+
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &ttou, &old);
+
+  tcsetpgrp(STDIN_FILENO, pgid);
+
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Record a process of a foreground job that exited
+static void foreground_reaped(pid_t pid, int status, struct rusage* ru,
+                              JobTime* time, Job* job, PidDeque* reaped) {
+  if (time != NULL)
+    job_time_reaped(time, pid, ru);
+
+  if (WIFSIGNALED(status) && is_limit_signal(WTERMSIG(status)))
+    fprintf(stderr, "%s\n", strsignal(WTERMSIG(status)));
+
+  if (job == NULL) {
+    push_back_PidDeque(reaped, pid);
+    return;
+  }
+
+  job_table_reap(pid);
+
+  // A pipeline succeeds or fails with its last stage
+  if (pid == job->pids[job->num_pids - 1])
+    job->status = status;
+}
+
+/**
+ * @brief Wait on a foreground job until all of its processes have exited or
+ * it was stopped
+ *
+ * The terminal is handed back to quash afterwards.
+ *
+ * @param pgid Process group of the job
+ *
+ * @param pids Processes of the job when @a job is NULL. Only needed without
+ * job control. The order is kept.
+ *
+ * @param time Usage of each reaped process is added here or NULL
+ *
+ * @param job The entry of the job if it is in the job table or NULL.
+ * Processes reaped here are removed from it.
+ *
+ * @param reaped Processes reaped here are added to this deque when @a job is
+ * NULL
+ *
+ * @return True if the job was stopped
+ */
+static bool wait_foreground(pid_t pgid, PidDeque* pids, JobTime* time,
+                            Job* job, PidDeque* reaped) {
+  struct rusage ru;
+  bool stopped = false;
+  int status;
+  pid_t pid;
+
+  if (!is_tty()) {
+    // Without job control the processes share the group of quash with the
+    // background jobs, so they are waited on one by one
+    size_t num_pids = (job != NULL) ? job->num_pids : length_PidDeque(pids);
+
+    for (size_t i = 0; i < num_pids; ++i) {
+      if (job != NULL) {
+        pid = job->pids[i];
+
+        if (job_table_find_pid(pid) != job)
+          continue;
+      }
+      else {
+        pid = pop_front_PidDeque(pids);
+        push_back_PidDeque(pids, pid);
+      }
+
+      if (stopped)
+        continue;
+
+      pid_t ret;
+
+      while ((ret = wait4(pid, &status, WUNTRACED, &ru)) < 0 && errno == EINTR)
+        ;
+
+      if (ret < 0)
+        continue;
+
+      if (WIFSTOPPED(status))
+        stopped = true;
+      else
+        foreground_reaped(pid, status, &ru, time, job, reaped);
+    }
+
+    return stopped;
+  }
+
+  // Every process of the job is in its group, so wait on the group as a
+  // whole rather than pid by pid. wait4() hands back the usage of each
+  // stage as it is reaped.
+  while ((pid = wait4(-pgid, &status, WUNTRACED, &ru)) > 0 || errno == EINTR) {
+    if (pid < 0)
+      continue;
+
+    // Ctrl-Z stops the whole group. The processes that are still alive are
+    // reaped once the job runs again.
+    if (WIFSTOPPED(status)) {
+      stopped = true;
+      break;
+    }
+
+    foreground_reaped(pid, status, &ru, time, job, reaped);
+  }
+
+  set_terminal_owner(getpgrp());
+
+  // A stopped program may have left the terminal in a mode of its own
+  if (stopped)
+    restore_terminal_modes();
+
+  return stopped;
+}
+
+// Make a process created for a stage part of its job
+static void add_stage_process(CommandHolder holder, Pipeline* pl, pid_t pid,
+                              PidDeque* pidDeque) {
+  // Fails harmlessly once the child has already joined the group itself
+  if (is_tty())
+    setpgid(pid, (pl->pgid != 0) ? pl->pgid : pid);
+
+  if (pl->pgid == 0) {
+    pl->pgid = pid;
+
+    // A foreground job takes over the terminal so keyboard signals reach it
+    // rather than quash
+    if (is_tty() && !(holder.flags & BACKGROUND))
+      set_terminal_owner(pid);
+  }
+
+  if (pl->time != NULL)
+    job_time_add_stage(pl->time, pid, (get_command_type(holder.cmd) == GENERIC) ?
+                       holder.cmd.generic.args[0] : "quash");
+
+  push_back_PidDeque(pidDeque, pid);
+}
+
+/**
+ * @brief Creates one new process centered around the @a Command in the @a
+ * CommandHolder setting up redirects and pipes where needed
+ *
+ * @note Processes are not the same as jobs. A single job can have multiple
+ * processes running under it. This function creates a process that is part of a
+ * larger job.
+ *
+ * @note Not all commands should be run in the child process. A few need to
+ * change the quash process in some way
+ *
+ * @param holder The CommandHolder to try to run
+ *
+ * @param pl The pipes of the job this process belongs to
+ *
+ * @param i Position of @a holder in the pipeline
+ *
+ * @param pidDeque The process id of the new process is added here
+ *
+ * @param stages Builtin stages run on a thread are added here
+ *
+ * @sa Command CommandHolder Pipeline
+ */
+void create_process(CommandHolder holder, Pipeline* pl, size_t i,
+                    PidDeque* pidDeque, StageDeque* stages) {
+  // Read the flags field from the parser
+  bool p_in  = holder.flags & PIPE_IN;
+  bool p_out = holder.flags & PIPE_OUT;
+  bool r_in  = holder.flags & REDIRECT_IN;
+  bool r_out = holder.flags & REDIRECT_OUT;
+  bool r_app = holder.flags & REDIRECT_APPEND; // This can only be true if r_out
+                                               // is true
+
+  const NamedBuiltin* named = find_named_builtin(holder.cmd);
+
+  // A builtin only needs its own process when it feeds or reads a pipe or
+  // runs in the background. Builtins that start processes always get one, so
+  // they have a group and the terminal to themselves like any other job.
+  if (!(holder.flags & (PIPE_IN | PIPE_OUT | BACKGROUND)) &&
+      is_builtin(holder.cmd) && (named == NULL || !named->own_process)) {
+    run_builtin_in_place(holder);
+    return;
+  }
+
+  // TODO: Setup pipes, redirects, and new process
+  pid_t pid;
+  int in_fd = p_in ? pl->pipes[i - 1][0] : -1;
+  int out_fd = p_out ? open_pipe(pl, i) : -1;
+
+  // Builtin stages of a foreground pipeline are fed to the pipe by a thread
+  // instead of a copy of quash
+  if (!(holder.flags & BACKGROUND) && is_builtin(holder.cmd) &&
+      (named == NULL || !named->own_process)) {
+    // The stage takes ownership of both pipe ends
+    if (p_in)
+      pl->pipes[i - 1][0] = -1;
+
+    if (p_out)
+      pl->pipes[i][1] = -1;
+
+    start_builtin_stage(holder, in_fd, out_fd, pl, pidDeque, stages);
+    return;
+  }
+
+  bool program = get_command_type(holder.cmd) == GENERIC && named == NULL;
+  const char* path = NULL;
+
+  // Search PATH before creating a process so a missing program never costs a
+  // fork
+  if (program && (path = path_cache_lookup(holder.cmd.generic.args[0])) == NULL) {
+    fprintf(stderr, "ERROR: Failed to execute program: %s\n", strerror(ENOENT));
+    pid = -1;
+  }
+  else if (program && use_fast_spawn() && pl->limits == NULL) {
+    // Generic commands do not need a copy of quash. Express the pipes and
+    // redirects as spawn file actions instead of setting them up in a child.
+    SpawnIO io = {
+      in_fd,
+      out_fd,
+      r_in ? holder.redirect_in : NULL,
+      r_out ? holder.redirect_out : NULL,
+      r_app
+    };
+
+    Placement saved;
+
+    // posix_spawn() gives the child the CPU mask and memory policy of the
+    // calling thread, so they are set around the spawn rather than in a child
+    if (pl->place != NULL)
+      apply_placement(pl->place, &saved);
+
+    if (pl->prio != NULL)
+      pid = spawn_with_priority(pl->prio, path, holder.cmd.generic.args, io,
+                                job_group(pl));
+    else
+      pid = spawn_generic(path, holder.cmd.generic.args, io, job_group(pl));
+
+    if (pl->place != NULL)
+      restore_placement(&saved);
+  }
+  else {
+    pid = fork();
+  }
+
+  if(pid == 0) //child
+  {
+    // Join the process group of the job. The parent does the same so neither
+    // side has to wait for the other.
+    if (is_tty())
+      setpgid(0, pl->pgid);
+
+    // Exits of children of this process are no business of the quash process
+    signal(SIGCHLD, SIG_DFL);
+
+    // Stop signals ignored by an interactive quash must stop the job again
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+
+    // posix_spawn() has no way to set limits, which is why limited jobs always
+    // take this path
+    if (pl->limits != NULL && !apply_resource_limits(pl->limits))
+      exit(EXIT_FAILURE);
+
+    if (pl->place != NULL)
+      apply_placement(pl->place, NULL);
+
+    if (pl->prio != NULL)
+      apply_priority(pl->prio);
+
+	  if (r_in)
+    {
+        FILE* file = fopen(holder.redirect_in, "r");
+        dup2(fileno(file), STDIN_FILENO);
+    }
+
+    if (r_out)
+    {
+		if(r_app)
+		{
+		FILE* file = fopen(holder.redirect_out , "a") ;
+        dup2(fileno(file), STDOUT_FILENO);
+		}
+		else
+		{
+        FILE* file = fopen(holder.redirect_out , "w") ;
+        dup2(fileno(file), STDOUT_FILENO);
+		}
+    }
+	
+    if (p_in)
+      dup2(in_fd, STDIN_FILENO);
+
+    if (p_out)
+      dup2(out_fd, STDOUT_FILENO);
+
+    // Builtins never reach exec so close-on-exec does not clean up after them
+    close_pipeline(pl);
+
+	child_run_command(holder.cmd); // This should be done in the child branch of a fork
+  exit(0);
+  }
+  else                              // a fork
+  {
+    // The child holds its own copies now. Closing them here is what lets the
+    // neighbouring stages see EOF and keeps quash from leaking descriptors.
+    if (p_in)
+      close_fd(&pl->pipes[i - 1][0]);
+
+    if (p_out)
+      close_fd(&pl->pipes[i][1]);
+
+	if (pid > 0)
+	  add_stage_process(holder, pl, pid, pidDeque);
+	parent_run_command(holder.cmd); 
+	}
+}
+
+/**
+ * @brief Turn a stage into the builtin its first argument names
+ *
+ * The parser only recognizes echo, export, cd, pwd, jobs and kill as the first
+ * word of a stage. Once a prefix keyword was dropped the stage is still a
+ * generic command, so it is given the command the parser would have made for
+ * the remaining arguments. Arguments the parser would have rejected leave the
+ * stage as it is.
+ *
+ * @param holder The first stage of a job
+ */
+static void classify_prefixed_stage(CommandHolder* holder) {
+  char** args = holder->cmd.generic.args;
+  size_t n = 0;
+  char* equals;
+
+  while (args[n] != NULL)
+    ++n;
+
+  if (n == 0)
+    return;
+
+  if (strcmp(args[0], "echo") == 0) {
+    holder->cmd = mk_echo_command(&args[1]);
+  }
+  else if (strcmp(args[0], "jobs") == 0) {
+    holder->cmd = mk_jobs_command(&args[1]);
+  }
+  else if (strcmp(args[0], "pwd") == 0 && n == 1) {
+    holder->cmd = mk_pwd_command();
+  }
+  else if (strcmp(args[0], "kill") == 0 && (n == 2 || n == 3)) {
+    holder->cmd = mk_kill_command((n == 3) ? args[1] : NULL, args[n - 1]);
+  }
+  else if (strcmp(args[0], "export") == 0 && n == 2 &&
+           (equals = strchr(args[1], '=')) != NULL && equals != args[1]) {
+    // The arguments are still part of the command string, so the name is
+    // split off into a copy
+    char* name = memory_pool_alloc(equals - args[1] + 1);
+
+    memcpy(name, args[1], equals - args[1]);
+    name[equals - args[1]] = '\0';
+    holder->cmd = mk_export_command(name, equals + 1);
+  }
+  else if (strcmp(args[0], "cd") == 0 && n <= 2) {
+    char* resolved = realpath((n == 2) ? args[1] : lookup_env("HOME"), NULL);
+
+    holder->cmd = mk_cd_command((resolved != NULL) ?
+                                memory_pool_strdup(resolved) : NULL);
+    free(resolved);
+  }
+}
+
+/**
+ * @brief Remove a leading time keyword from a job
+ *
+ * The parser sees `time [-s] command ...` as a generic command named time, so
+ * the keyword and its option are dropped from the arguments of the first
+ * stage and the stage becomes the builtin it names, if any.
+ *
+ * @param holders The job
+ *
+ * @param per_stage Set when the -s option asks for a line per stage
+ *
+ * @return True if the job should be timed
+ */
+static bool strip_time_prefix(CommandHolder* holders, bool* per_stage) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return false;
+
+  char** args = holders[0].cmd.generic.args;
+
+  if (strcmp(args[0], "time") != 0)
+    return false;
+
+  ++args;
+  *per_stage = args[0] != NULL && strcmp(args[0], "-s") == 0;
+
+  if (*per_stage)
+    ++args;
+
+  holders[0].cmd.generic.args = args;
+  classify_prefixed_stage(&holders[0]);
+
+  return true;
+}
+
+/**
+ * @brief Hold a background job until other jobs finish
+ *
+ * The parser sees `after [-c] %N ... command ...` as a generic command named
+ * after. The keyword, option and job specs are dropped from the arguments of
+ * the first stage and the job is added to the job table as a pending job that
+ * starts once every listed job has finished. With -c the job is cancelled
+ * instead if a listed job fails. A listed job that already finished counts by
+ * the outcome recorded for it.
+ *
+ * @param holders The job
+ *
+ * @return True if the job was handled here
+ */
+static bool queue_after_job(CommandHolder* holders) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return false;
+
+  char** args = holders[0].cmd.generic.args;
+
+  if (strcmp(args[0], "after") != 0)
+    return false;
+
+  bool cancel = args[1] != NULL && strcmp(args[1], "-c") == 0;
+  size_t first = cancel ? 2 : 1;
+  size_t n = first;
+
+  while (args[n] != NULL && args[n][0] == '%')
+    ++n;
+
+  if (n == first || args[n] == NULL || !(holders[0].flags & BACKGROUND)) {
+    fprintf(stderr, "after: usage: after [-c] %%job ... command ... &\n");
+    return true;
+  }
+
+  int* after = malloc((n - first) * sizeof(int));
+  size_t num_after = 0;
+  bool failed = false;
+
+  for (size_t i = first; i < n; ++i) {
+    char* end;
+    long id = strtol(args[i] + 1, &end, 10);
+    JobOutcome outcome = (*end == '\0') ? job_table_outcome(id) : JOB_UNKNOWN;
+
+    if (*end != '\0' || (job_table_find(id) == NULL && outcome == JOB_UNKNOWN)) {
+      fprintf(stderr, "after: %s: no such job\n", args[i]);
+      free(after);
+      return true;
+    }
+
+    // There is nothing left to wait on for a job that already finished
+    if (job_table_find(id) == NULL) {
+      failed |= outcome == JOB_FAILED;
+      continue;
+    }
+
+    // A job listed twice only finishes once
+    size_t k = 0;
+
+    while (k < num_after && after[k] != id)
+      ++k;
+
+    if (k == num_after)
+      after[num_after++] = id;
+  }
+
+  holders[0].cmd.generic.args = &args[n];
+
+  Job* job = job_table_add_pending(get_command_string(), copy_script(holders));
+
+  job->after = after;
+  job->num_after = num_after;
+  job->cancel_on_failure = cancel;
+
+  printf("Background job queued: ");
+  fprint_job_state(stdout, job->job_id, "Pending", job->cmd);
+
+  if (failed && cancel) {
+    cancel_pending_job(job);
+  }
+  else if (num_after == 0) {
+    push_back_JobDeque(&pending_jobs, job);
+    start_pending_jobs(false);
+  }
+  else {
+    push_back_JobDeque(&blocked_jobs, job);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Remove a leading on keyword from a job
  *
- * @sa Command
+ * The parser sees `on cpus=LIST|node=N ... command ...` as a generic command
+ * named on, so the keyword and its placements are dropped from the arguments
+ * of the first stage.
+ *
+ * @param holders The job
+ *
+ * @param place The placements are added here. Left untouched if the job has no
+ * on keyword.
+ *
+ * @return False if the placement is invalid and the job must not run
  */
-void parent_run_command(Command cmd) {
-  CommandType type = get_command_type(cmd);
+static bool strip_on_prefix(CommandHolder* holders, Placement* place) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return true;
 
-  switch (type) {
-  case EXPORT:
-    run_export(cmd.export);
-    break;
+  char** args = holders[0].cmd.generic.args;
 
-  case CD:
-    run_cd(cmd.cd);
-    break;
+  if (args[0] == NULL || strcmp(args[0], "on") != 0)
+    return true;
 
-  case KILL:
-    run_kill(cmd.kill);
-    break;
+  size_t n = 1;
 
-  case GENERIC:
-  case ECHO:
-  case PWD:
-  case JOBS:
-  case EXIT:
-  case EOC:
-    break;
+  for (; args[n] != NULL && strchr(args[n], '=') != NULL; ++n) {
+    if (!parse_placement(place, args[n])) {
+      fprintf(stderr, "on: %s: invalid placement\n", args[n]);
+      return false;
+    }
+  }
 
-  default:
-    fprintf(stderr, "Unknown command type: %d\n", type);
+  if (n == 1 || args[n] == NULL) {
+    fprintf(stderr, "on: usage: on cpus=LIST|node=N ... command ...\n");
+    return false;
   }
+
+  holders[0].cmd.generic.args = &args[n];
+
+  return true;
 }
 
 /**
- * @brief Creates one new process centered around the @a Command in the @a
- * CommandHolder setting up redirects and pipes where needed
+ * @brief Remove a leading nice keyword from a job
  *
- * @note Processes are not the same as jobs. A single job can have multiple
- * processes running under it. This function creates a process that is part of a
- * larger job.
+ * `nice [-n N] [-b] [-i CLASS] command ...` adds N, or 10 if it is not given,
+ * to the nice value of the job. -b runs the job under SCHED_BATCH and -i sets
+ * its I/O class. This replaces the nice program so the priority is set without
+ * an extra exec.
  *
- * @note Not all commands should be run in the child process. A few need to
- * change the quash process in some way
+ * @param holders The job
  *
- * @param holder The CommandHolder to try to run
+ * @param prio The priority is stored here. Left untouched if the job has no
+ * nice keyword.
  *
- * @sa Command CommandHolder
+ * @return False if the options are invalid and the job must not run
  */
-void create_process(CommandHolder holder, int i, PidDeque* pidDeque) {
-  // Read the flags field from the parser
-  bool p_in  = holder.flags & PIPE_IN;
-  bool p_out = holder.flags & PIPE_OUT;
-  bool r_in  = holder.flags & REDIRECT_IN;
-  bool r_out = holder.flags & REDIRECT_OUT;
-  bool r_app = holder.flags & REDIRECT_APPEND; // This can only be true if r_out
-                                               // is true
+static bool strip_nice_prefix(CommandHolder* holders, Priority* prio) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return true;
 
-  // TODO: Setup pipes, redirects, and new process
-  pid_t pid;
-  int write = i % 2;
-  int read = (i-1)%2;
-  
-  if(p_out)
-	pipe(pipes[write]);
+  char** args = holders[0].cmd.generic.args;
 
-  pid = fork();
-  if(pid == 0) //child
-  {
-	  if (r_in)
-    {
-        FILE* file = fopen(holder.redirect_in, "r");
-        dup2(fileno(file), STDIN_FILENO);
-    }
+  if (args[0] == NULL || strcmp(args[0], "nice") != 0)
+    return true;
 
-    if (r_out)
-    {
-		if(r_app)
-		{
-		FILE* file = fopen(holder.redirect_out , "a") ;
-        dup2(fileno(file), STDOUT_FILENO);
-		}
-		else
-		{
-        FILE* file = fopen(holder.redirect_out , "w") ;
-        dup2(fileno(file), STDOUT_FILENO);
-		}
+  Priority p = new_priority();
+  size_t n = 1;
+
+  p.nice = 10;
+
+  for (; args[n] != NULL && args[n][0] == '-'; ++n) {
+    char* end = NULL;
+
+    if (strcmp(args[n], "-b") == 0) {
+      p.batch = true;
+    }
+    else if (strcmp(args[n], "-n") == 0 && args[n + 1] != NULL &&
+             (p.nice = strtol(args[n + 1], &end, 10), *end == '\0')) {
+      ++n;
+    }
+    else if (strcmp(args[n], "-i") == 0 && args[n + 1] != NULL &&
+             parse_io_class(&p, args[n + 1])) {
+      ++n;
+    }
+    else {
+      break;
     }
-	
-	  if(p_in)
-	  {
-	 dup2(pipes[read][0], STDIN_FILENO);
-	 close(pipes[read][0]);
-	  }
-	  if(p_out)
-	  {
-		dup2(pipes[write][1], STDOUT_FILENO);
-		close(pipes[write][1]);
-	  }
-	child_run_command(holder.cmd); // This should be done in the child branch of a fork
-  exit(0);
   }
-  else                              // a fork
-  {
-	if(p_out)
-	{
-		close(pipes[write][1]);
-	}
-	push_back_PidDeque(pidDeque, pid);
-	parent_run_command(holder.cmd); 
-	}
+
+  if (args[n] == NULL || args[n][0] == '-') {
+    fprintf(stderr, "nice: usage: nice [-n N] [-b] [-i idle|best-effort[:LEVEL]] "
+            "command ...\n");
+    return false;
+  }
+
+  *prio = p;
+  holders[0].cmd.generic.args = &args[n];
+
+  return true;
+}
+
+/**
+ * @brief Remove a leading ulimit keyword from a job
+ *
+ * `ulimit -t|-v|-n|-u VALUE ... command ...` limits only the job, while ulimit
+ * without a command sets the limits of the session and is left to the
+ * builtin.
+ *
+ * @param holders The job
+ *
+ * @param limits The limits are added here. Left untouched if the job has no
+ * ulimit keyword.
+ *
+ * @return True. Invalid limits are reported by the builtin instead.
+ */
+static bool strip_ulimit_prefix(CommandHolder* holders, ResourceLimits* limits) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return true;
+
+  char** args = holders[0].cmd.generic.args;
+
+  if (args[0] == NULL || strcmp(args[0], "ulimit") != 0)
+    return true;
+
+  ResourceLimits parsed = *limits;
+  size_t n = parse_resource_limits(&parsed, args, false);
+
+  if (n != 0 && args[n] != NULL) {
+    *limits = parsed;
+    holders[0].cmd.generic.args = &args[n];
+  }
+
+  return true;
+}
+
+// Create an empty set of prefixes
+static JobPrefixes new_job_prefixes() {
+  JobPrefixes prefixes = {
+    new_placement(),
+    new_priority(),
+    new_resource_limits()
+  };
+
+  return prefixes;
+}
+
+// Remove the on, nice and ulimit keywords in front of a job in any order.
+// Returns false if the job must not run.
+static bool strip_run_prefixes(CommandHolder* holders, JobPrefixes* prefixes) {
+  if (get_command_holder_type(holders[0]) != GENERIC)
+    return true;
+
+  char** start = holders[0].cmd.generic.args;
+  char** args;
+
+  do {
+    args = holders[0].cmd.generic.args;
+
+    if (!strip_on_prefix(holders, &prefixes->place) ||
+        !strip_nice_prefix(holders, &prefixes->prio) ||
+        !strip_ulimit_prefix(holders, &prefixes->limits))
+      return false;
+  } while (holders[0].cmd.generic.args != args);
+
+  if (args != start)
+    classify_prefixed_stage(&holders[0]);
+
+  return true;
+}
+
+// Create the processes of every stage of a job. Returns the process group of
+// the job or 0 if no process was created.
+static pid_t start_stages(CommandHolder* holders, JobTime* time,
+                          JobPrefixes* prefixes, PidDeque* pids,
+                          StageDeque* stages) {
+  Pipeline pl = new_pipeline(holders);
+  Placement* place = &prefixes->place;
+  bool background = holders[0].flags & BACKGROUND;
+
+  pl.time = time;
+
+  if (priority_is_set(&prefixes->prio))
+    pl.prio = &prefixes->prio;
+  else if (background && priority_is_set(&background_prio))
+    pl.prio = &background_prio;
+
+  if (place->has_cpus || place->node >= 0) {
+    pl.place = place;
+  }
+  else if (spread_jobs && background) {
+    *place = next_spread_placement();
+    pl.place = place;
+  }
+
+  if (have_resource_limits(&prefixes->limits))
+    pl.limits = &prefixes->limits;
+
+  // Run all commands in the `holder` array
+  for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
+    create_process(holders[i], &pl, i, pids, stages);
+
+  destroy_pipeline(&pl);
+
+  return pl.pgid;
+}
+
+/**
+ * @brief Add a background job that was just started to the job table
+ *
+ * @param pending The entry of the job if it was queued first or NULL
+ *
+ * @param pgid Process group of the job
+ *
+ * @param pids Processes of the job. The deque is emptied.
+ *
+ * @param token Jobserver token taken for the job
+ */
+static void track_background_job(Job* pending, pid_t pgid, PidDeque* pids,
+                                 int token) {
+  size_t num_pids = length_PidDeque(pids);
+
+  if (num_pids == 0) {
+    // Nothing was started so there is no job to track
+    if (pending != NULL)
+      job_table_remove(pending);
+
+    jobserver_release(token);
+    return;
+  }
+
+  pid_t pid_list[num_pids];
+
+  for (size_t i = 0; i < num_pids; ++i)
+    pid_list[i] = pop_front_PidDeque(pids);
+
+  Job* job = (pending != NULL) ?
+    job_table_start(pending, pgid, pid_list, num_pids) :
+    job_table_add(get_command_string(), pgid, pid_list, num_pids);
+
+  job->token = token;
+  ++running_jobs;
+  print_job_bg_start(job->job_id, pid_list[num_pids - 1], job->cmd);
+}
+
+// Tell the user a job was stopped
+static void report_stopped_job(Job* job) {
+  // The terminal echoed ^Z without a newline
+  if (is_tty())
+    putchar('\n');
+
+  printf("Stopped: \t");
+  print_job(job->job_id, job->pids[0], job->cmd);
+}
+
+/**
+ * @brief Add a foreground job that was stopped to the job table so fg or bg
+ * can resume it
+ *
+ * @param pgid Process group of the job
+ *
+ * @param pids Processes of the job. The deque is emptied.
+ *
+ * @param reaped Processes of the job that already exited. The deque is
+ * emptied.
+ *
+ * @param stages Builtin stages of the job. They are kept until the job is
+ * done and the deque is left empty.
+ */
+static void track_stopped_job(pid_t pgid, PidDeque* pids, PidDeque* reaped,
+                              StageDeque* stages) {
+  size_t num_pids = length_PidDeque(pids);
+  pid_t pid_list[num_pids];
+
+  for (size_t i = 0; i < num_pids; ++i)
+    pid_list[i] = pop_front_PidDeque(pids);
+
+  Job* job = job_table_add(get_command_string(), pgid, pid_list, num_pids);
+
+  while (!is_empty_PidDeque(reaped))
+    job_table_reap(pop_front_PidDeque(reaped));
+
+  job->stopped = true;
+  ++running_jobs;
+
+  park_builtin_stages(job->job_id, stages);
+  report_stopped_job(job);
+}
+
+/**
+ * @brief Start queued background jobs while there are free job slots, the
+ * pressure is not too high and the jobserver hands out tokens
+ *
+ * @param below_prompt Start the messages on a new line when quash is at the
+ * prompt
+ *
+ * @return True if any job was started
+ */
+static bool start_pending_jobs(bool below_prompt) {
+  bool any = false;
+  int token;
+
+  while (running_jobs < job_limit() && !is_empty_JobDeque(&pending_jobs) &&
+         check_pressure() != PRESSURE_HIGH && jobserver_acquire(&token)) {
+    if (!any && below_prompt && is_tty())
+      putchar('\n');
+
+    any = true;
+
+    Job* job = pop_front_JobDeque(&pending_jobs);
+    PidDeque pids = new_PidDeque(1);
+    StageDeque stages = new_StageDeque(1);
+    CommandHolder first = job->script[0];
+    JobPrefixes prefixes = new_job_prefixes();
+
+    // The prefixes were checked when the job was queued
+    strip_run_prefixes(job->script, &prefixes);
+
+    pid_t pgid = start_stages(job->script, NULL, &prefixes, &pids, &stages);
+
+    // The copy is freed through its original arguments
+    job->script[0] = first;
+
+    track_background_job(job, pgid, &pids, token);
+
+    destroy_PidDeque(&pids);
+    destroy_StageDeque(&stages);
+  }
+
+  return any;
 }
 
 // Run a list of commands
@@ -393,10 +2595,18 @@ void run_script(CommandHolder* holders) {
   if (holders == NULL)
     return;
 
-if(init){
-	jobs = new_JobDeque(1);
-	init=false;
-}
+  if (init) {
+    pending_jobs = new_JobDeque(1);
+    blocked_jobs = new_JobDeque(1);
+    initialize_child_events();
+
+    // Jobs left stopped for pressure would be killed by the hangup sent to
+    // orphaned groups with stopped processes once quash exits
+    atexit(resume_throttled_jobs);
+    atexit(release_job_tokens);
+
+    init = false;
+  }
 
   check_jobs_bg_status();
 
@@ -406,36 +2616,186 @@ if(init){
     return;
   }
 
-  	Job new_job;
-	new_job.job_id =job_id;
-	new_job.pidDeque = new_PidDeque(1);
-	new_job.cmd = get_command_string();
-  
-  CommandType type;
+  if (queue_after_job(holders))
+    return;
 
-  // Run all commands in the `holder` array
-  for (int i = 0; (type = get_command_holder_type(holders[i])) != EOC; ++i)
-    create_process(holders[i], i, &new_job.pidDeque);
+  bool per_stage = false;
+  bool timed = strip_time_prefix(holders, &per_stage);
+  bool background = holders[0].flags & BACKGROUND;
+
+  // Nothing follows the keyword
+  if (timed && get_command_holder_type(holders[0]) == GENERIC &&
+      holders[0].cmd.generic.args[0] == NULL) {
+    JobTime jt = new_job_time();
+
+    job_time_report(&jt, stderr, false);
+    return;
+  }
+
+  CommandHolder first = holders[0];
+  JobPrefixes prefixes = new_job_prefixes();
+
+  if (!strip_run_prefixes(holders, &prefixes))
+    return;
+
+  int token = JOBSERVER_NO_TOKEN;
+
+  // Every job slot is taken, the machine is under pressure or the jobserver
+  // has no token to spare. Keep a copy of the job to start once a slot frees
+  // up. Jobs queued earlier go first.
+  if (background &&
+      (running_jobs >= job_limit() || !is_empty_JobDeque(&pending_jobs) ||
+       check_pressure() == PRESSURE_HIGH || !jobserver_acquire(&token))) {
+    // The placement and priority are applied once the job starts
+    holders[0] = first;
+
+    Job* job = job_table_add_pending(get_command_string(), copy_script(holders));
+
+    push_back_JobDeque(&pending_jobs, job);
 
-  if (!(holders[0].flags & BACKGROUND)) {
+    printf("Background job queued: ");
+    fprint_job_state(stdout, job->job_id, "Pending", job->cmd);
+    return;
+  }
+
+  JobTime jt = new_job_time();
+  PidDeque pids = new_PidDeque(1);
+  StageDeque stages = new_StageDeque(1);
+
+  // Only foreground jobs are waited on, so only they can be timed
+  pid_t pgid = start_stages(holders, (timed && !background) ? &jt : NULL,
+                            &prefixes, &pids, &stages);
+
+  if (!background) {
     // Not a background Job
-    // TODO: Wait for all processes under the job to complete
-	while(!is_empty_PidDeque(&new_job.pidDeque))
-	{
-		pid_t pid = pop_front_PidDeque(&new_job.pidDeque);
-		int status;
-		waitpid(pid, &status, 0);
-	}
-	  destroy_PidDeque(&new_job.pidDeque);
-	  free(new_job.cmd);
+    PidDeque reaped = new_PidDeque(1);
+    bool stopped = false;
+
+    if (pgid != 0) {
+      // A stage that touched the terminal before it was handed over was
+      // stopped by SIGTTIN or SIGTTOU. Let it carry on now that it owns it.
+      if (is_tty())
+        kill(-pgid, SIGCONT);
+
+      stopped = wait_foreground(pgid, &pids, timed ? &jt : NULL, NULL, &reaped);
+    }
+
+    if (stopped) {
+      track_stopped_job(pgid, &pids, &reaped, &stages);
+    }
+    else {
+      // The job is only done once its builtin stages have written everything
+      join_builtin_stages(&stages);
+
+      if (timed)
+        job_time_report(&jt, stderr, per_stage);
+    }
+
+    destroy_PidDeque(&reaped);
   }
   else {
-	  job_id++;
-    // A background job.
-    // TODO: Push the new job to the job queue
-	push_back_JobDeque(&jobs, new_job);
-    // TODO: Once jobs are implemented, uncomment and fill the following line
-    print_job_bg_start(new_job.job_id, peek_back_PidDeque(&new_job.pidDeque), new_job.cmd);
-	
+    track_background_job(NULL, pgid, &pids, token);
+  }
+
+  destroy_PidDeque(&pids);
+  destroy_StageDeque(&stages);
+  destroy_job_time(&jt);
+}
+
+/***************************************************************************
+ * Job control
+ ***************************************************************************/
+
+// Find the job fg or bg acts on. Without a job spec that is the stopped job
+// with the highest id or else the running job with the highest id.
+static Job* find_job_arg(char** args) {
+  if (args[1] != NULL && args[2] != NULL) {
+    fprintf(stderr, "%s: usage: %s [%%job]\n", args[0], args[0]);
+    return NULL;
+  }
+
+  Job* job = NULL;
+
+  if (args[1] != NULL) {
+    char* end;
+    long id = strtol(args[1] + (args[1][0] == '%'), &end, 10);
+
+    if (*end != '\0' || (job = job_table_find(id)) == NULL) {
+      fprintf(stderr, "%s: %s: no such job\n", args[0], args[1]);
+      return NULL;
+    }
+  }
+  else {
+    for (Job* j = job_table_next(0); j != NULL; j = job_table_next(j->job_id))
+      if (j->num_pids > 0 && (job == NULL || j->stopped || !job->stopped))
+        job = j;
+
+    if (job == NULL) {
+      fprintf(stderr, "%s: no current job\n", args[0]);
+      return NULL;
+    }
+  }
+
+  if (job->num_pids == 0) {
+    fprintf(stderr, "%s: %s: job has not started\n", args[0], args[1]);
+    return NULL;
+  }
+
+  return job;
+}
+
+// Continues a job in the foreground
+void run_fg(char** args) {
+  Job* job = find_job_arg(args);
+
+  if (job == NULL)
+    return;
+
+  fprintf(builtin_stream(), "%s\n", job->cmd);
+  fflush(builtin_stream());
+
+  if (is_tty())
+    set_terminal_owner(job->pgid);
+
+  job->stopped = false;
+  job->throttled = false;
+
+  if (job->live > 0)
+    signal_job(job, SIGCONT);
+
+  if (wait_foreground(job->pgid, NULL, NULL, job, NULL)) {
+    job->stopped = true;
+    report_stopped_job(job);
+    return;
   }
+
+  // The job finished in the foreground, so there is nothing to report
+  int job_id = job->job_id;
+  int job_status = job->status;
+
+  release_builtin_stages(job_id);
+  jobserver_release(job->token);
+  job_table_remove(job);
+  --running_jobs;
+
+  release_dependents(job_id, !WIFEXITED(job_status) ||
+                     WEXITSTATUS(job_status) != 0);
+  start_pending_jobs(false);
+}
+
+// Continues a stopped job in the background
+void run_bg(char** args) {
+  Job* job = find_job_arg(args);
+
+  if (job == NULL)
+    return;
+
+  job->stopped = false;
+  job->throttled = false;
+
+  if (job->live > 0 && !signal_job(job, SIGCONT))
+    perror("bg");
+
+  fprintf(builtin_stream(), "Background job continued: ");
+  fprint_job(builtin_stream(), job->job_id, job->pids[0], job->cmd);
 }
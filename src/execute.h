@@ -22,6 +22,19 @@
  */
 const char* lookup_env(const char* env_var);
 
+/**
+ * @brief Function to get environment variable values by a name that is not
+ * NUL terminated
+ *
+ * @param name Start of the name of the environment variable
+ *
+ * @param len Length of the name
+ *
+ * @return String containing the value of the environment variable or NULL if
+ * it is not set
+ */
+const char* lookup_env_len(const char* name, size_t len);
+
 /**
  * @brief Function to set and define environment variable values
  *
@@ -49,6 +62,19 @@ char* get_current_directory();
  */
 void check_jobs_bg_status();
 
+/**
+ * @brief Block until input is available on a file descriptor
+ *
+ * Background jobs that finish in the meantime are reaped and reported right
+ * away instead of when the next command is run.
+ *
+ * @param fd File descriptor to wait on
+ *
+ * @return True once @a fd is readable. False after finished jobs were
+ * reported, so a prompt can be printed again.
+ */
+bool wait_for_input(int fd);
+
 /**
  * @brief Print a job to standard out
  *
@@ -147,9 +173,87 @@ void run_pwd();
 /**
  * @brief Run the builtin jobs command to show the jobs list
  *
- * @sa PWDCommand
+ * With -l the processes of each job are listed as well, along with the reason
+ * if one of them was killed for exceeding a resource limit.
+ *
+ * --stats shows the state, CPU use, resident memory and storage I/O of each
+ * job summed over its processes, read from /proc. CPU use is averaged since the
+ * previous sample or over the lifetime of a process on the first one. -l adds a
+ * row per process. --top redraws the same table every second until Enter is
+ * pressed or no job is left, and acts like --stats when quash is not reading
+ * from a terminal.
+ *
+ * @param cmd JobsCommand holding the options
+ *
+ * @sa JobsCommand
+ */
+void run_jobs(JobsCommand cmd);
+
+/**
+ * @brief Run the builtin hash command
+ *
+ * With no arguments the cached executable locations are printed. The -r option
+ * empties the cache and any other arguments are resolved and added to it.
+ *
+ * @param args A NULL terminated array of strings starting with "hash"
+ */
+void run_hash(char** args);
+
+/**
+ * @brief Run the builtin wait command
+ *
+ * Blocks until the given jobs, or every background job when none are given,
+ * have finished. The -n option returns as soon as any one of them finishes and
+ * -t gives up after a number of seconds. Jobs may be given as N or %N.
+ *
+ * @param args A NULL terminated array of strings starting with "wait"
+ */
+void run_wait(char** args);
+
+/**
+ * @brief Run the builtin set command
+ *
+ * `set -o maxjobs N` limits the number of background jobs running at once.
+ * Jobs started past the limit are queued and started in order as running jobs
+ * finish. The limit defaults to the number of online CPUs. `set -o spread on`
+ * places each background job without an on prefix on the next NUMA node, or
+ * on the next CPU of a single node machine. `set -o bgprio off|nice|idle|batch`
+ * lowers the priority of background jobs without a nice prefix as described
+ * for parse_priority_preset(). `set -o cpupressure|mempressure|iopressure
+ * off|PERCENT` sets a threshold on the share of time tasks stalled on the
+ * resource over the last ten seconds. While it is exceeded background jobs are
+ * queued rather than started and the youngest running job is stopped, and the
+ * stopped jobs are continued once the pressure is low again, as described in
+ * pressure.h. `set -o jobserver off|SLOTS` runs a GNU make jobserver with the
+ * given number of slots that make processes started by quash share with its
+ * background jobs, as described in jobserver.h. Whenever MAKEFLAGS names a
+ * jobserver each background job waits in the queue for a token from it. `set
+ * -o` prints the current options.
+ *
+ * @param args A NULL terminated array of strings starting with "set"
+ */
+void run_set(char** args);
+
+/**
+ * @brief Run the builtin fg command
+ *
+ * Continues a job as the foreground job and waits for it to finish or to be
+ * stopped again. Without a job spec the stopped job with the highest id is chosen,
+ * or else the running job with the highest id.
+ *
+ * @param args A NULL terminated array of strings starting with "fg"
+ */
+void run_fg(char** args);
+
+/**
+ * @brief Run the builtin bg command
+ *
+ * Continues a stopped job in the background. The job is chosen as for
+ * run_fg().
+ *
+ * @param args A NULL terminated array of strings starting with "bg"
  */
-void run_jobs();
+void run_bg(char** args);
 
 /**
  * @brief Common entry point for all commands
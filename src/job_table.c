@@ -0,0 +1,308 @@
+/**
+ * @file job_table.c
+ *
+ * @brief Implements the background job table
+ */
+
+#include "job_table.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Maps a process id to the job it belongs to
+ *
+ * A pid of zero marks an empty slot.
+ */
+typedef struct PidSlot {
+  pid_t pid; /**< Process id used as the key */
+  Job* job;  /**< Job the process belongs to */
+} PidSlot;
+
+// Job id `i + 1` is stored in `by_id[i]` and is in use when bit `i` of
+// `id_bits` is set. The last job under it ended as `outcomes[i]`.
+static Job** by_id = NULL;
+static unsigned char* outcomes = NULL;
+static uint64_t* id_bits = NULL;
+static size_t id_words = 0;
+
+// No word before this one has a clear bit
+static size_t free_hint = 0;
+
+static PidSlot* pid_slots = NULL;
+static size_t pid_cap = 0;
+static size_t pid_len = 0;
+
+// Number of jobs started so far, giving the start order of each job
+static uint64_t num_started = 0;
+
+/***************************************************************************
+ * Job ids
+ ***************************************************************************/
+
+// Double the number of job ids the table can hold
+static void __grow_ids() {
+  size_t old_words = id_words;
+
+  id_words = (id_words == 0) ? 1 : 2 * id_words;
+  id_bits = realloc(id_bits, id_words * sizeof(uint64_t));
+  by_id = realloc(by_id, 64 * id_words * sizeof(Job*));
+  outcomes = realloc(outcomes, 64 * id_words);
+
+  memset(id_bits + old_words, 0, (id_words - old_words) * sizeof(uint64_t));
+  memset(by_id + 64 * old_words, 0, 64 * (id_words - old_words) * sizeof(Job*));
+  memset(outcomes + 64 * old_words, JOB_UNKNOWN, 64 * (id_words - old_words));
+}
+
+// Claim the smallest free job id
+static int __alloc_id() {
+  while (free_hint < id_words && id_bits[free_hint] == UINT64_MAX)
+    ++free_hint;
+
+  if (free_hint == id_words)
+    __grow_ids();
+
+  size_t bit = __builtin_ctzll(~id_bits[free_hint]);
+
+  id_bits[free_hint] |= 1ULL << bit;
+
+  return (int) (64 * free_hint + bit + 1);
+}
+
+static void __free_id(int job_id) {
+  size_t word = (job_id - 1) / 64;
+
+  id_bits[word] &= ~(1ULL << ((job_id - 1) % 64));
+  by_id[job_id - 1] = NULL;
+
+  if (word < free_hint)
+    free_hint = word;
+}
+
+/***************************************************************************
+ * Process ids
+ ***************************************************************************/
+
+static size_t __pid_home(pid_t pid) {
+  return ((size_t) pid * 2654435761u) & (pid_cap - 1);
+}
+
+static void __insert_pid(pid_t pid, Job* job) {
+  size_t i = __pid_home(pid);
+
+  while (pid_slots[i].pid != 0)
+    i = (i + 1) & (pid_cap - 1);
+
+  pid_slots[i] = (PidSlot) { pid, job };
+  ++pid_len;
+}
+
+// Double the size of the pid table and reinsert every entry
+static void __grow_pids() {
+  PidSlot* old = pid_slots;
+  size_t old_cap = pid_cap;
+
+  pid_cap = (pid_cap == 0) ? 64 : 2 * pid_cap;
+  pid_slots = calloc(pid_cap, sizeof(PidSlot));
+  pid_len = 0;
+
+  for (size_t i = 0; i < old_cap; ++i)
+    if (old[i].pid != 0)
+      __insert_pid(old[i].pid, old[i].job);
+
+  free(old);
+}
+
+static PidSlot* __find_pid(pid_t pid) {
+  if (pid_cap == 0 || pid <= 0)
+    return NULL;
+
+  for (size_t i = __pid_home(pid); pid_slots[i].pid != 0; i = (i + 1) & (pid_cap - 1))
+    if (pid_slots[i].pid == pid)
+      return &pid_slots[i];
+
+  return NULL;
+}
+
+// Empty a slot. Later members of the probe run are shifted back so lookups
+// never stop early at the hole left behind.
+static void __erase_pid(PidSlot* slot) {
+  size_t mask = pid_cap - 1;
+  size_t hole = slot - pid_slots;
+
+  for (size_t j = (hole + 1) & mask; pid_slots[j].pid != 0; j = (j + 1) & mask) {
+    size_t home = __pid_home(pid_slots[j].pid);
+
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      pid_slots[hole] = pid_slots[j];
+      hole = j;
+    }
+  }
+
+  pid_slots[hole].pid = 0;
+  --pid_len;
+}
+
+/***************************************************************************
+ * Interface
+ ***************************************************************************/
+
+// Add a job under the smallest free job id
+Job* job_table_add(char* cmd, pid_t pgid, const pid_t* pids, size_t num_pids) {
+  return job_table_start(job_table_add_pending(cmd, NULL), pgid, pids, num_pids);
+}
+
+// Add a job that has not been started yet
+Job* job_table_add_pending(char* cmd, CommandHolder* script) {
+  Job* job = malloc(sizeof(Job));
+
+  job->job_id = __alloc_id();
+  job->pgid = 0;
+  job->num_pids = 0;
+  job->live = 0;
+  job->status = 0;
+  job->cmd = cmd;
+  job->script = script;
+  job->after = NULL;
+  job->num_after = 0;
+  job->cancel_on_failure = false;
+  job->limit_signal = 0;
+  job->stopped = false;
+  job->throttled = false;
+  job->started = 0;
+  job->token = -1;
+
+  by_id[job->job_id - 1] = job;
+
+  return job;
+}
+
+// Give a pending job its processes
+Job* job_table_start(Job* job, pid_t pgid, const pid_t* pids, size_t num_pids) {
+  if (job->script != NULL)
+    destroy_script_copy(job->script);
+
+  free(job->after);
+
+  job = realloc(job, sizeof(Job) + num_pids * sizeof(pid_t));
+
+  job->pgid = pgid;
+  job->started = ++num_started;
+  job->num_pids = num_pids;
+  job->live = num_pids;
+  job->script = NULL;
+  job->after = NULL;
+  job->num_after = 0;
+  memcpy(job->pids, pids, num_pids * sizeof(pid_t));
+
+  by_id[job->job_id - 1] = job;
+
+  while (4 * (pid_len + num_pids) > 3 * pid_cap)
+    __grow_pids();
+
+  for (size_t i = 0; i < num_pids; ++i)
+    __insert_pid(pids[i], job);
+
+  return job;
+}
+
+// Find a job by job id
+Job* job_table_find(int job_id) {
+  if (job_id <= 0 || (size_t) job_id > 64 * id_words)
+    return NULL;
+
+  return by_id[job_id - 1];
+}
+
+// Find the job an unreaped process belongs to
+Job* job_table_find_pid(pid_t pid) {
+  PidSlot* slot = __find_pid(pid);
+
+  return (slot == NULL) ? NULL : slot->job;
+}
+
+// Forget a reaped process
+Job* job_table_reap(pid_t pid) {
+  PidSlot* slot = __find_pid(pid);
+
+  if (slot == NULL)
+    return NULL;
+
+  Job* job = slot->job;
+
+  __erase_pid(slot);
+  --job->live;
+
+  return job;
+}
+
+// Remove a job and free it
+void job_table_remove(Job* job) {
+  for (size_t i = 0; job->live > 0 && i < job->num_pids; ++i)
+    if (job_table_find_pid(job->pids[i]) == job)
+      job_table_reap(job->pids[i]);
+
+  if (job->script != NULL)
+    destroy_script_copy(job->script);
+
+  __free_id(job->job_id);
+  free(job->after);
+  free(job->cmd);
+  free(job);
+}
+
+// Record how a job ended
+void job_table_set_outcome(int job_id, JobOutcome outcome) {
+  outcomes[job_id - 1] = outcome;
+}
+
+// Look up how the last job under a job id ended
+JobOutcome job_table_outcome(int job_id) {
+  if (job_id <= 0 || (size_t) job_id > 64 * id_words)
+    return JOB_UNKNOWN;
+
+  return outcomes[job_id - 1];
+}
+
+// Find the job with the next larger job id
+Job* job_table_next(int job_id) {
+  size_t bit = (job_id < 0) ? 0 : (size_t) job_id;
+  size_t word = bit / 64;
+
+  if (word >= id_words)
+    return NULL;
+
+  uint64_t bits = id_bits[word] & (UINT64_MAX << (bit % 64));
+
+  while (bits == 0) {
+    if (++word == id_words)
+      return NULL;
+
+    bits = id_bits[word];
+  }
+
+  return by_id[64 * word + __builtin_ctzll(bits)];
+}
+
+// Remove every job and release the table
+void destroy_job_table() {
+  Job* job;
+
+  while ((job = job_table_next(0)) != NULL)
+    job_table_remove(job);
+
+  free(by_id);
+  free(outcomes);
+  free(id_bits);
+  free(pid_slots);
+
+  by_id = NULL;
+  outcomes = NULL;
+  id_bits = NULL;
+  pid_slots = NULL;
+  id_words = 0;
+  free_hint = 0;
+  pid_cap = 0;
+  pid_len = 0;
+}
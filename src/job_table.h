@@ -0,0 +1,186 @@
+/**
+ * @file job_table.h
+ *
+ * @brief Table of the background jobs started by quash.
+ *
+ * Jobs are found by job id through a directly indexed array and by process id
+ * through a hash table, so neither lookup depends on the number of jobs. Job
+ * ids are handed out through a bitmap that always yields the smallest free id,
+ * and iteration visits jobs in job id order.
+ *
+ * A job may be added before its processes exist. Such a pending job holds on
+ * to its script until it is started. A foreground job that is stopped joins
+ * the table so it can be resumed later.
+ *
+ * How the last job under each job id ended is kept after the job is removed,
+ * so jobs that wait on it can still tell once it is gone.
+ */
+
+#ifndef SRC_JOB_TABLE_H
+#define SRC_JOB_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "command.h"
+
+/**
+ * @brief How the last job under a job id ended
+ */
+typedef enum JobOutcome {
+  JOB_UNKNOWN = 0, /**< No job under the id has finished yet */
+  JOB_SUCCEEDED,   /**< The job exited with status zero */
+  JOB_FAILED,      /**< The job failed, was killed or was cancelled */
+} JobOutcome;
+
+/**
+ * @brief A background job and the processes belonging to it
+ */
+typedef struct Job {
+  int job_id;        /**< Job id shown to the user */
+  pid_t pgid;        /**< Process group holding every process of the job. Without
+                      * job control the first process of the job. */
+  uint32_t num_pids; /**< Number of processes started for the job. Zero while
+                      * the job is pending. */
+  uint32_t live;     /**< Processes of the job that have not been reaped */
+  int status;        /**< Wait status of the last stage once it was reaped */
+  char* cmd;         /**< Command line that started the job */
+  CommandHolder* script; /**< Copy of the script of a pending job or NULL */
+  int* after;        /**< Ids of jobs that must finish before a pending job
+                      * may start */
+  uint32_t num_after; /**< Number of entries in @a after */
+  bool cancel_on_failure; /**< Cancel the pending job if a job in @a after
+                           * fails */
+  int limit_signal;  /**< Signal that killed a process of the job for exceeding
+                      * a resource limit or 0 */
+  bool stopped;      /**< The job was stopped and has not been continued since */
+  bool throttled;    /**< The job was stopped by quash because of pressure */
+  uint64_t started;  /**< Jobs started later have larger values. Zero while the
+                      * job is pending. */
+  int token;         /**< Jobserver token held by the job or -1 */
+  pid_t pids[];      /**< Processes in the order they were started */
+} Job;
+
+/**
+ * @brief Add a job to the table under the smallest free job id
+ *
+ * @param cmd Command line of the job. Ownership passes to the table.
+ *
+ * @param pgid Process group of the job
+ *
+ * @param pids Processes belonging to the job
+ *
+ * @param num_pids Number of entries in @a pids. Must not be zero.
+ *
+ * @return The new job
+ */
+Job* job_table_add(char* cmd, pid_t pgid, const pid_t* pids, size_t num_pids);
+
+/**
+ * @brief Add a job that has not been started yet under the smallest free job
+ * id
+ *
+ * @param cmd Command line of the job. Ownership passes to the table.
+ *
+ * @param script Copy of the script to run when the job starts. Ownership
+ * passes to the table.
+ *
+ * @return The new job
+ *
+ * @sa copy_script
+ */
+Job* job_table_add_pending(char* cmd, CommandHolder* script);
+
+/**
+ * @brief Record the processes of a pending job that was started
+ *
+ * The script of the job is freed.
+ *
+ * @param job A pending job
+ *
+ * @param pgid Process group of the job
+ *
+ * @param pids Processes belonging to the job
+ *
+ * @param num_pids Number of entries in @a pids. Must not be zero.
+ *
+ * @return The job. It may have moved, so @a job must not be used again.
+ */
+Job* job_table_start(Job* job, pid_t pgid, const pid_t* pids, size_t num_pids);
+
+/**
+ * @brief Find a job by job id
+ *
+ * @param job_id Job id to look for
+ *
+ * @return The job or NULL if no job has that id
+ */
+Job* job_table_find(int job_id);
+
+/**
+ * @brief Find the job an unreaped process belongs to
+ *
+ * @param pid Process id to look for
+ *
+ * @return The job or NULL if the process is not part of a job or was already
+ * reaped
+ */
+Job* job_table_find_pid(pid_t pid);
+
+/**
+ * @brief Record that a process has been reaped
+ *
+ * The process is removed from the table and the live count of its job is
+ * decremented. The job itself stays in the table until it is removed.
+ *
+ * @param pid Process id that was reaped
+ *
+ * @return The job the process belonged to or NULL if it was not part of a job
+ */
+Job* job_table_reap(pid_t pid);
+
+/**
+ * @brief Remove a job from the table and free it
+ *
+ * The job id becomes available again.
+ *
+ * @param job Job to remove
+ */
+void job_table_remove(Job* job);
+
+/**
+ * @brief Record how a job ended
+ *
+ * @param job_id Id of a job that finished or was cancelled
+ *
+ * @param outcome How the job ended
+ */
+void job_table_set_outcome(int job_id, JobOutcome outcome);
+
+/**
+ * @brief Look up how the last job under a job id ended
+ *
+ * @param job_id Job id to look for
+ *
+ * @return The outcome recorded for the id or @a JOB_UNKNOWN
+ */
+JobOutcome job_table_outcome(int job_id);
+
+/**
+ * @brief Iterate over the jobs in job id order
+ *
+ * @param job_id Job id to continue after. Pass zero to get the first job.
+ *
+ * @return The job with the smallest id greater than @a job_id or NULL if there
+ * is none
+ */
+Job* job_table_next(int job_id);
+
+/**
+ * @brief Remove every job and free all memory held by the table
+ */
+void destroy_job_table();
+
+#endif
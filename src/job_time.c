@@ -0,0 +1,157 @@
+/**
+ * @file job_time.c
+ *
+ * @brief Implements resource usage collection and reporting for the time prefix
+ */
+
+#include "job_time.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "execute.h"
+
+// Layout used when TIMEFORMAT is not set
+#define DEFAULT_TIMEFORMAT                                              \
+  "\nreal\t%3R\nuser\t%3U\nsys\t%3S\nmaxrss\t%MKB\nmajflt\t%F\nctxsw\t%w+%c"
+
+static double __tv_seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Seconds since the job was started
+static double __elapsed(const JobTime* jt) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - jt->start.tv_sec) +
+    (now.tv_nsec - jt->start.tv_nsec) / 1e9;
+}
+
+// Print one report in the given format
+static void __print_format(FILE* out, const char* fmt, double real,
+                           const struct rusage* ru) {
+  double user = __tv_seconds(ru->ru_utime);
+  double sys = __tv_seconds(ru->ru_stime);
+
+  for (const char* c = fmt; *c != '\0'; ++c) {
+    if (*c == '\\' && (c[1] == 'n' || c[1] == 't')) {
+      fputc((*++c == 'n') ? '\n' : '\t', out);
+      continue;
+    }
+
+    if (*c != '%' || c[1] == '\0') {
+      fputc(*c, out);
+      continue;
+    }
+
+    int precision = 3;
+
+    ++c;
+
+    if (*c >= '0' && *c <= '9') {
+      precision = (*c - '0' > 3) ? 3 : *c - '0';
+      ++c;
+    }
+
+    switch (*c) {
+    case 'R': fprintf(out, "%.*f", precision, real); break;
+    case 'U': fprintf(out, "%.*f", precision, user); break;
+    case 'S': fprintf(out, "%.*f", precision, sys); break;
+    case 'P': fprintf(out, "%.2f", (real > 0) ? 100 * (user + sys) / real : 0); break;
+    case 'M': fprintf(out, "%ld", ru->ru_maxrss); break;
+    case 'F': fprintf(out, "%ld", ru->ru_majflt); break;
+    case 'w': fprintf(out, "%ld", ru->ru_nvcsw); break;
+    case 'c': fprintf(out, "%ld", ru->ru_nivcsw); break;
+    case '%': fputc('%', out); break;
+    default:
+      fputc('%', out);
+      fputc(*c, out);
+    }
+  }
+
+  fputc('\n', out);
+}
+
+// Add the usage of one process to a running total
+static void __add_usage(struct rusage* total, const struct rusage* ru) {
+  timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+  timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+
+  // Stages run side by side, so the peak of the job is the largest peak of any
+  // one stage rather than their sum
+  if (ru->ru_maxrss > total->ru_maxrss)
+    total->ru_maxrss = ru->ru_maxrss;
+
+  total->ru_majflt += ru->ru_majflt;
+  total->ru_nvcsw += ru->ru_nvcsw;
+  total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+// Start timing a job
+JobTime new_job_time() {
+  JobTime jt = { { 0, 0 }, NULL, 0, 0 };
+
+  clock_gettime(CLOCK_MONOTONIC, &jt.start);
+
+  return jt;
+}
+
+// Record a process started for a timed job
+void job_time_add_stage(JobTime* jt, pid_t pid, const char* name) {
+  if (jt->num_stages == jt->cap) {
+    jt->cap = (jt->cap == 0) ? 4 : 2 * jt->cap;
+    jt->stages = realloc(jt->stages, jt->cap * sizeof(StageTime));
+  }
+
+  StageTime* stage = &jt->stages[jt->num_stages++];
+
+  memset(stage, 0, sizeof(StageTime));
+  stage->pid = pid;
+  stage->name = name;
+}
+
+// Record the usage of a reaped process
+void job_time_reaped(JobTime* jt, pid_t pid, const struct rusage* ru) {
+  for (size_t i = 0; i < jt->num_stages; ++i) {
+    if (jt->stages[i].pid == pid) {
+      jt->stages[i].real = __elapsed(jt);
+      jt->stages[i].ru = *ru;
+      return;
+    }
+  }
+}
+
+// Print the usage of a job
+void job_time_report(const JobTime* jt, FILE* out, bool per_stage) {
+  const char* fmt = lookup_env("TIMEFORMAT");
+  struct rusage total;
+
+  memset(&total, 0, sizeof(total));
+
+  for (size_t i = 0; i < jt->num_stages; ++i) {
+    const StageTime* stage = &jt->stages[i];
+
+    __add_usage(&total, &stage->ru);
+
+    if (per_stage)
+      fprintf(out, "[%zu] %-16s real %.3f user %.3f sys %.3f maxrss %ldKB "
+              "majflt %ld ctxsw %ld+%ld\n", i + 1, stage->name, stage->real,
+              __tv_seconds(stage->ru.ru_utime), __tv_seconds(stage->ru.ru_stime),
+              stage->ru.ru_maxrss, stage->ru.ru_majflt, stage->ru.ru_nvcsw,
+              stage->ru.ru_nivcsw);
+  }
+
+  __print_format(out, (fmt != NULL) ? fmt : DEFAULT_TIMEFORMAT, __elapsed(jt),
+                 &total);
+  fflush(out);
+}
+
+// Free memory held by a JobTime
+void destroy_job_time(JobTime* jt) {
+  free(jt->stages);
+  jt->stages = NULL;
+  jt->num_stages = jt->cap = 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file job_time.h
+ *
+ * @brief Resource usage of a foreground job for the time prefix.
+ *
+ * The usage of each process is collected as it is reaped with wait4(), so a
+ * pipeline can be reported stage by stage as well as a whole. The report
+ * layout is taken from the TIMEFORMAT environment variable.
+ */
+
+#ifndef SRC_JOB_TIME_H
+#define SRC_JOB_TIME_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * @brief Usage of one process of a timed job
+ */
+typedef struct StageTime {
+  pid_t pid;          /**< Process id of the stage */
+  const char* name;   /**< Name of the program run by the stage */
+  double real;        /**< Seconds from the start of the job until the stage
+                       * was reaped */
+  struct rusage ru;   /**< Usage reported when the stage was reaped */
+} StageTime;
+
+/**
+ * @brief Usage of a timed job
+ */
+typedef struct JobTime {
+  struct timespec start; /**< When the job was started */
+  StageTime* stages;     /**< Processes of the job in pipeline order */
+  size_t num_stages;     /**< Number of entries in @a stages */
+  size_t cap;            /**< Capacity of @a stages */
+} JobTime;
+
+/**
+ * @brief Start timing a job
+ *
+ * @return An empty JobTime whose wall clock starts now
+ */
+JobTime new_job_time();
+
+/**
+ * @brief Record a process started for a timed job
+ *
+ * @param jt The job
+ *
+ * @param pid Process id of the new stage
+ *
+ * @param name Name of the program. Must outlive @a jt.
+ */
+void job_time_add_stage(JobTime* jt, pid_t pid, const char* name);
+
+/**
+ * @brief Record the usage of a process that was reaped
+ *
+ * @param jt The job
+ *
+ * @param pid Process id that was reaped
+ *
+ * @param ru Usage returned by wait4()
+ */
+void job_time_reaped(JobTime* jt, pid_t pid, const struct rusage* ru);
+
+/**
+ * @brief Print the usage of a job
+ *
+ * The totals are printed with the format in TIMEFORMAT. It understands %R, %U
+ * and %S for real, user and system seconds with an optional precision digit
+ * (e.g. %2U), %P for CPU percentage, %M for the largest resident set size of
+ * any stage in kilobytes, %F for major page faults, %w and %c for voluntary
+ * and involuntary context switches and the escapes \\n and \\t.
+ *
+ * @param jt The job
+ *
+ * @param out Stream to print the report to
+ *
+ * @param per_stage Also print one line for each process of the job
+ */
+void job_time_report(const JobTime* jt, FILE* out, bool per_stage);
+
+/**
+ * @brief Free memory held by a JobTime
+ *
+ * @param jt The job
+ */
+void destroy_job_time(JobTime* jt);
+
+#endif
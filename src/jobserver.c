@@ -0,0 +1,302 @@
+/**
+ * @file jobserver.c
+ *
+ * @brief Implements the GNU make jobserver client and server
+ */
+
+#define _GNU_SOURCE // for asprintf
+
+#include "jobserver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+// Largest number of slots of the jobserver of quash. The tokens have to fit
+// into the pipe without blocking.
+#define MAX_SERVER_SLOTS 4096
+
+// MAKEFLAGS the client descriptors were opened for or NULL
+static char* client_flags = NULL;
+
+// Non-blocking read side and write side of the jobserver. Both are the same
+// descriptor for a fifo.
+static int read_fd = -1;
+static int write_fd = -1;
+
+// The implicit slot of quash is not used by a background job
+static bool implicit_free = true;
+
+// Pipe and number of slots of the jobserver of quash. No slots means it is not
+// running.
+static int server_fds[2] = { -1, -1 };
+static long server_slots = 0;
+
+// MAKEFLAGS from before the jobserver of quash was started or NULL if it was
+// not set
+static char* saved_makeflags = NULL;
+
+static void __close_client() {
+  if (write_fd >= 0 && write_fd != read_fd)
+    close(write_fd);
+
+  if (read_fd >= 0)
+    close(read_fd);
+
+  read_fd = -1;
+  write_fd = -1;
+
+  free(client_flags);
+  client_flags = NULL;
+}
+
+// Copy the value of the last jobserver option in MAKEFLAGS. Returns false if
+// there is none.
+static bool __find_auth(const char* flags, char* auth, size_t size) {
+  // make before 4.2 called the option --jobserver-fds
+  static const char* options[] = { "--jobserver-auth=", "--jobserver-fds=" };
+  const char* last = NULL;
+  const char* value = NULL;
+
+  for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+    for (const char* c = flags; (c = strstr(c, options[i])) != NULL; ++c) {
+      if (last == NULL || c > last) {
+        last = c;
+        value = c + strlen(options[i]);
+      }
+    }
+  }
+
+  if (value == NULL)
+    return false;
+
+  size_t len = strcspn(value, " ");
+
+  if (len == 0 || len >= size)
+    return false;
+
+  memcpy(auth, value, len);
+  auth[len] = '\0';
+
+  return true;
+}
+
+// Open a pipe inherited from make a second time. The new open file description
+// can be made non-blocking without affecting make or the other clients.
+static int __reopen(int fd, int flags) {
+  char path[64];
+  struct stat st;
+
+  // make names its descriptors in MAKEFLAGS even where it closed them, so
+  // they may be missing or something else entirely
+  if (fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode))
+    return -1;
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+  return open(path, flags | O_CLOEXEC);
+}
+
+// Open the jobserver named by MAKEFLAGS if it changed since the last call
+static void __update_client() {
+  const char* flags = lookup_env("MAKEFLAGS");
+
+  if (flags == NULL)
+    flags = "";
+
+  if (client_flags != NULL && strcmp(flags, client_flags) == 0)
+    return;
+
+  __close_client();
+  client_flags = strdup(flags);
+
+  char auth[PATH_MAX];
+
+  if (!__find_auth(flags, auth, sizeof(auth)))
+    return;
+
+  if (strncmp(auth, "fifo:", 5) == 0) {
+    // Holding both ends keeps the fifo from reading as closed
+    struct stat st;
+    int fd = open(auth + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode))) {
+      close(fd);
+      fd = -1;
+    }
+
+    read_fd = write_fd = fd;
+    return;
+  }
+
+  int r, w;
+  char extra;
+
+  if (sscanf(auth, "%d,%d%c", &r, &w, &extra) != 2)
+    return;
+
+  if ((read_fd = __reopen(r, O_RDONLY | O_NONBLOCK)) < 0)
+    return;
+
+  if ((write_fd = __reopen(w, O_WRONLY)) < 0) {
+    close(read_fd);
+    read_fd = -1;
+  }
+}
+
+// Take a job slot without blocking
+bool jobserver_acquire(int* token) {
+  unsigned char c;
+
+  __update_client();
+
+  *token = JOBSERVER_NO_TOKEN;
+
+  if (read_fd < 0)
+    return true;
+
+  if (implicit_free) {
+    implicit_free = false;
+    *token = JOBSERVER_IMPLICIT;
+    return true;
+  }
+
+  // Other clients read from the same pipe, so a token seen by poll() may be
+  // gone by now
+  if (read(read_fd, &c, 1) != 1)
+    return false;
+
+  *token = c;
+
+  return true;
+}
+
+// Give back a job slot
+void jobserver_release(int token) {
+  if (token == JOBSERVER_IMPLICIT) {
+    implicit_free = true;
+    return;
+  }
+
+  if (token < 0 || write_fd < 0)
+    return;
+
+  // make expects the very byte it handed out back
+  unsigned char c = token;
+
+  while (write(write_fd, &c, 1) < 0 && errno == EINTR)
+    ;
+}
+
+// Get a descriptor to poll for a token
+int jobserver_poll_fd() {
+  __update_client();
+
+  return read_fd;
+}
+
+// Close the pipe of the jobserver of quash and put MAKEFLAGS back
+static void __stop_server() {
+  if (server_slots == 0)
+    return;
+
+  close(server_fds[0]);
+  close(server_fds[1]);
+  server_fds[0] = server_fds[1] = -1;
+  server_slots = 0;
+
+  if (saved_makeflags != NULL)
+    setenv("MAKEFLAGS", saved_makeflags, 1);
+  else
+    unsetenv("MAKEFLAGS");
+
+  free(saved_makeflags);
+  saved_makeflags = NULL;
+}
+
+// Start or stop the jobserver of quash
+bool set_jobserver(const char* value) {
+  if (strcmp(value, "off") == 0) {
+    __stop_server();
+    return true;
+  }
+
+  char* end;
+  long slots = strtol(value, &end, 10);
+
+  if (end == value || *end != '\0' || slots < 1 || slots > MAX_SERVER_SLOTS)
+    return false;
+
+  // The slots of a make that started quash are not quash's to hand out
+  __update_client();
+
+  if (read_fd >= 0 && server_slots == 0)
+    return false;
+
+  __stop_server();
+
+  // The descriptors are inherited by every process quash starts, which is how
+  // make finds them
+  if (pipe(server_fds) != 0)
+    return false;
+
+  char tokens[MAX_SERVER_SLOTS];
+
+  memset(tokens, '+', slots - 1);
+
+  if (slots > 1 && write(server_fds[1], tokens, slots - 1) != slots - 1) {
+    close(server_fds[0]);
+    close(server_fds[1]);
+    server_fds[0] = server_fds[1] = -1;
+    return false;
+  }
+
+  const char* old = lookup_env("MAKEFLAGS");
+  char* flags;
+
+  saved_makeflags = (old != NULL) ? strdup(old) : NULL;
+
+  // A later -j and --jobserver-auth take precedence over earlier ones
+  if (asprintf(&flags, "%s%s-j%ld --jobserver-auth=%d,%d",
+               (old != NULL) ? old : "", (old != NULL && *old != '\0') ? " " : "",
+               slots, server_fds[0], server_fds[1]) >= 0) {
+    setenv("MAKEFLAGS", flags, 1);
+    free(flags);
+  }
+
+  server_slots = slots;
+
+  return true;
+}
+
+// Print the jobserver option
+void print_jobserver(FILE* out) {
+  __update_client();
+
+  if (server_slots > 0)
+    fprintf(out, "jobserver\t%ld\n", server_slots);
+  else if (read_fd >= 0)
+    fprintf(out, "jobserver\tmake\n");
+  else
+    fprintf(out, "jobserver\toff\n");
+}
+
+// Close every jobserver descriptor
+void destroy_jobserver() {
+  __close_client();
+
+  if (server_slots > 0) {
+    close(server_fds[0]);
+    close(server_fds[1]);
+  }
+
+  free(saved_makeflags);
+  saved_makeflags = NULL;
+}
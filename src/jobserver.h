@@ -0,0 +1,89 @@
+/**
+ * @file jobserver.h
+ *
+ * @brief Sharing job slots with GNU make through its jobserver.
+ *
+ * make hands out job slots as single bytes, called tokens, through a pipe or
+ * a fifo named by --jobserver-auth in MAKEFLAGS. Every process make starts
+ * holds one implicit slot and must read a token for each further job it runs
+ * at the same time, then write the token back once that job is done.
+ *
+ * Quash acts as a client whenever MAKEFLAGS names a jobserver, so its
+ * background jobs count against the -j of the make that started it. MAKEFLAGS
+ * is checked again before every job, so exporting it takes effect right away.
+ * Quash can also run a jobserver of its own that the make processes it starts
+ * share with its background jobs.
+ */
+
+#ifndef SRC_JOBSERVER_H
+#define SRC_JOBSERVER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Token value of a job that holds no job slot
+ */
+#define JOBSERVER_NO_TOKEN (-1)
+
+/**
+ * @brief Token value of a job that holds the implicit job slot of quash
+ */
+#define JOBSERVER_IMPLICIT (-2)
+
+/**
+ * @brief Take a job slot for a background job without blocking
+ *
+ * @param token The token to return through jobserver_release() is stored
+ * here. It is JOBSERVER_NO_TOKEN if there is no jobserver.
+ *
+ * @return False if the job has to wait for a token
+ */
+bool jobserver_acquire(int* token);
+
+/**
+ * @brief Give back a job slot taken by jobserver_acquire()
+ *
+ * @param token The token. JOBSERVER_NO_TOKEN is ignored.
+ */
+void jobserver_release(int token);
+
+/**
+ * @brief Get a descriptor to poll for a token
+ *
+ * @return A descriptor that becomes readable when a token may be available or
+ * -1 if there is no jobserver
+ */
+int jobserver_poll_fd();
+
+/**
+ * @brief Start or stop the jobserver of quash
+ *
+ * The jobserver is a pipe holding one token less than the number of slots,
+ * for the implicit slot of quash. Its descriptors are inherited by every
+ * process quash starts and named in MAKEFLAGS together with -j. Stopping it
+ * restores MAKEFLAGS.
+ *
+ * @param value `off` or the number of job slots
+ *
+ * @return False if @a value is invalid or quash is already the client of a
+ * jobserver that is not its own
+ */
+bool set_jobserver(const char* value);
+
+/**
+ * @brief Print the jobserver option
+ *
+ * The value is the number of slots of the jobserver of quash, `make` if quash
+ * is the client of another jobserver or `off`.
+ *
+ * @param out Stream to print to
+ */
+void print_jobserver(FILE* out);
+
+/**
+ * @brief Close every jobserver descriptor and free all memory held for it
+ */
+void destroy_jobserver();
+
+#endif
@@ -0,0 +1,385 @@
+/**
+ * @file parallel.c
+ *
+ * @brief Implements the parallel builtin
+ */
+
+#define _GNU_SOURCE // for pipe2
+
+#include "parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "path_cache.h"
+#include "spawner.h"
+
+/**
+ * @brief Where the items of a parallel run come from
+ */
+typedef struct ItemSource {
+  char** list;    /**< Items given after ::: or NULL to read standard in */
+  char* buf;      /**< Data read from standard in that is not used yet */
+  size_t len;     /**< Number of bytes in @a buf */
+  size_t cap;     /**< Capacity of @a buf */
+  bool eof;       /**< Standard in has been read to the end */
+} ItemSource;
+
+/**
+ * @brief A running worker
+ */
+typedef struct Worker {
+  pid_t pid;   /**< Process id or 0 when the slot is free */
+  int pidfd;   /**< Process descriptor or -1 once the worker was reaped */
+  int out_fd;  /**< Read end of the output pipe or -1 */
+  size_t item; /**< Index of the item the worker runs */
+} Worker;
+
+/**
+ * @brief Output of one item collected for -k
+ */
+typedef struct ItemOutput {
+  char* buf;  /**< Collected output */
+  size_t len; /**< Number of bytes in @a buf */
+  size_t cap; /**< Capacity of @a buf */
+  bool done;  /**< The worker for the item has finished */
+} ItemOutput;
+
+// Get the next item. Returns a malloc'd string or NULL when there are no more.
+static char* __next_item(ItemSource* src) {
+  if (src->list != NULL)
+    return (*src->list != NULL) ? strdup(*src->list++) : NULL;
+
+  while (true) {
+    char* nl = memchr(src->buf, '\n', src->len);
+
+    if (nl != NULL || (src->eof && src->len > 0)) {
+      size_t n = (nl != NULL) ? (size_t) (nl - src->buf) : src->len;
+      char* item = strndup(src->buf, n);
+      size_t used = (nl != NULL) ? n + 1 : n;
+
+      memmove(src->buf, src->buf + used, src->len - used);
+      src->len -= used;
+
+      return item;
+    }
+
+    if (src->eof)
+      return NULL;
+
+    if (src->len == src->cap) {
+      src->cap = (src->cap == 0) ? 4096 : 2 * src->cap;
+      src->buf = realloc(src->buf, src->cap);
+    }
+
+    ssize_t n = read(STDIN_FILENO, src->buf + src->len, src->cap - src->len);
+
+    if (n > 0)
+      src->len += n;
+    else if (n == 0 || errno != EINTR)
+      src->eof = true;
+  }
+}
+
+// Replace every {} in a template argument with the item
+static char* __substitute(const char* arg, const char* item) {
+  size_t item_len = strlen(item);
+  size_t len = 0;
+
+  for (const char* c = arg; *c != '\0'; ++c) {
+    if (c[0] == '{' && c[1] == '}') {
+      len += item_len;
+      ++c;
+    }
+    else {
+      ++len;
+    }
+  }
+
+  char* out = malloc(len + 1);
+  char* o = out;
+
+  for (const char* c = arg; *c != '\0'; ++c) {
+    if (c[0] == '{' && c[1] == '}') {
+      memcpy(o, item, item_len);
+      o += item_len;
+      ++c;
+    }
+    else {
+      *o++ = *c;
+    }
+  }
+
+  *o = '\0';
+
+  return out;
+}
+
+// Start a worker for one item. Returns false if it could not be started.
+static bool __start_worker(Worker* w, char** cmd, size_t argc, const char* item,
+                           bool keep, size_t index) {
+  bool placeholder = false;
+
+  for (size_t i = 0; i < argc; ++i)
+    placeholder = placeholder || strstr(cmd[i], "{}") != NULL;
+
+  char** argv = malloc((argc + 2) * sizeof(char*));
+
+  for (size_t i = 0; i < argc; ++i)
+    argv[i] = __substitute(cmd[i], item);
+
+  argv[argc] = placeholder ? NULL : strdup(item);
+  argv[argc + 1] = NULL;
+
+  const char* path = path_cache_lookup(argv[0]);
+  int pipe_fds[2] = { -1, -1 };
+
+  if (path == NULL)
+    fprintf(stderr, "parallel: %s: command not found\n", argv[0]);
+  else if (keep && pipe2(pipe_fds, O_CLOEXEC) != 0)
+    perror("ERROR: Failed to create pipe");
+  else {
+    // Workers must not eat items meant for later workers
+    SpawnIO io = { -1, pipe_fds[1], "/dev/null", NULL, false };
+
+    // Workers share the group of the caller so a signal sent to the job
+    // reaches them too
+    w->pid = spawn_generic(path, argv, io, getpgrp());
+  }
+
+  for (size_t i = 0; argv[i] != NULL; ++i)
+    free(argv[i]);
+
+  free(argv);
+
+  if (pipe_fds[1] >= 0)
+    close(pipe_fds[1]);
+
+  if (path == NULL || (keep && pipe_fds[0] < 0) || w->pid <= 0) {
+    if (pipe_fds[0] >= 0)
+      close(pipe_fds[0]);
+
+    w->pid = 0;
+    return false;
+  }
+
+  if (pipe_fds[0] >= 0)
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+  w->pidfd = open_pidfd(w->pid);
+  w->out_fd = pipe_fds[0];
+  w->item = index;
+
+  return true;
+}
+
+// Move whatever a worker has written into the buffer of its item
+static void __collect_output(Worker* w, ItemOutput* out) {
+  while (true) {
+    if (out->cap - out->len < 4096) {
+      out->cap = (out->cap == 0) ? 4096 : 2 * out->cap;
+      out->buf = realloc(out->buf, out->cap);
+    }
+
+    ssize_t n = read(w->out_fd, out->buf + out->len, out->cap - out->len);
+
+    if (n > 0) {
+      out->len += n;
+    }
+    else if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    else {
+      if (n == 0 || errno != EAGAIN) {
+        close(w->out_fd);
+        w->out_fd = -1;
+      }
+
+      return;
+    }
+  }
+}
+
+// Write out every finished item that no earlier unfinished item holds back
+static void __emit_ready(ItemOutput* outs, size_t num_items, size_t* next) {
+  for (; *next < num_items && outs[*next].done; ++*next) {
+    ItemOutput* out = &outs[*next];
+
+    for (size_t off = 0; off < out->len;) {
+      ssize_t n = write(STDOUT_FILENO, out->buf + off, out->len - off);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        break;
+
+      off += n;
+    }
+
+    free(out->buf);
+    out->buf = NULL;
+  }
+}
+
+// Runs a command for each input item with a bounded number of workers
+void run_parallel(char** args) {
+  size_t max_workers = 0;
+  bool keep = false;
+  int i = 1;
+
+  for (; args[i] != NULL && args[i][0] == '-'; ++i) {
+    char* end = NULL;
+    long n;
+
+    if (strcmp(args[i], "-k") == 0) {
+      keep = true;
+    }
+    else if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL &&
+             (n = strtol(args[i + 1], &end, 10)) > 0 && *end == '\0') {
+      max_workers = n;
+      ++i;
+    }
+    else {
+      fprintf(stderr, "parallel: usage: parallel [-j N] [-k] command [args ...] "
+              "[::: item ...]\n");
+      return;
+    }
+  }
+
+  char** cmd = &args[i];
+  size_t cmd_len = 0;
+  ItemSource src = { NULL, NULL, 0, 0, false };
+
+  // Split the command from an explicit list of items. The arguments belong to
+  // the parsed script, so they are left as they are.
+  while (cmd[cmd_len] != NULL && strcmp(cmd[cmd_len], ":::") != 0)
+    ++cmd_len;
+
+  if (cmd[cmd_len] != NULL)
+    src.list = &cmd[cmd_len + 1];
+
+  if (cmd_len == 0) {
+    fprintf(stderr, "parallel: no command given\n");
+    return;
+  }
+
+  if (max_workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    max_workers = (cpus > 0) ? cpus : 1;
+  }
+
+  // Anything quash printed must come out before the workers write
+  fflush(stdout);
+
+  Worker* workers = calloc(max_workers, sizeof(Worker));
+  struct pollfd* fds = malloc(2 * max_workers * sizeof(struct pollfd));
+  ItemOutput* outs = NULL;
+  size_t num_items = 0;
+  size_t outs_cap = 0;
+  size_t next_emit = 0;
+  size_t active = 0;
+  bool more = true;
+
+  while (more || active > 0) {
+    // Hand out items to free worker slots
+    for (size_t w = 0; more && w < max_workers; ++w) {
+      if (workers[w].pid != 0)
+        continue;
+
+      char* item = __next_item(&src);
+
+      if (item == NULL) {
+        more = false;
+        break;
+      }
+
+      if (num_items == outs_cap) {
+        outs_cap = (outs_cap == 0) ? 64 : 2 * outs_cap;
+        outs = realloc(outs, outs_cap * sizeof(ItemOutput));
+      }
+
+      outs[num_items] = (ItemOutput) { NULL, 0, 0, false };
+
+      if (__start_worker(&workers[w], cmd, cmd_len, item, keep, num_items))
+        ++active;
+      else
+        outs[num_items].done = true;
+
+      ++num_items;
+      free(item);
+    }
+
+    if (keep)
+      __emit_ready(outs, num_items, &next_emit);
+
+    if (active == 0)
+      continue;
+
+    // Without a process descriptor a worker has to be checked for by polling
+    bool fallback = false;
+
+    for (size_t w = 0; w < max_workers; ++w) {
+      bool running = workers[w].pid != 0;
+
+      fallback = fallback || (running && workers[w].pidfd < 0);
+      fds[2 * w] = (struct pollfd) { running ? workers[w].pidfd : -1, POLLIN, 0 };
+      fds[2 * w + 1] = (struct pollfd) { running ? workers[w].out_fd : -1, POLLIN, 0 };
+    }
+
+    if (poll(fds, 2 * max_workers, fallback ? 10 : -1) < 0 && errno != EINTR)
+      break;
+
+    for (size_t w = 0; w < max_workers; ++w) {
+      Worker* wk = &workers[w];
+
+      if (wk->pid == 0)
+        continue;
+
+      if (wk->out_fd >= 0 && fds[2 * w + 1].revents != 0)
+        __collect_output(wk, &outs[wk->item]);
+
+      if (wk->pidfd >= 0 && fds[2 * w].revents == 0)
+        continue;
+
+      int status;
+
+      if (waitpid(wk->pid, &status, WNOHANG) != wk->pid)
+        continue;
+
+      if (wk->pidfd >= 0)
+        close(wk->pidfd);
+
+      // Whatever is left in the pipe belongs to the item as well
+      if (wk->out_fd >= 0) {
+        fcntl(wk->out_fd, F_SETFL, 0);
+
+        while (wk->out_fd >= 0)
+          __collect_output(wk, &outs[wk->item]);
+      }
+
+      outs[wk->item].done = true;
+      wk->pid = 0;
+      --active;
+    }
+  }
+
+  if (keep)
+    __emit_ready(outs, num_items, &next_emit);
+
+  for (size_t j = next_emit; j < num_items; ++j)
+    free(outs[j].buf);
+
+  free(outs);
+  free(fds);
+  free(workers);
+  free(src.buf);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file parallel.h
+ *
+ * @brief The parallel builtin.
+ *
+ * Runs one command per input item with a bounded number of workers. Workers
+ * are started through the posix_spawn() path, so neither a helper process such
+ * as xargs nor a second round of argument parsing is needed per item.
+ */
+
+#ifndef SRC_PARALLEL_H
+#define SRC_PARALLEL_H
+
+/**
+ * @brief Run the builtin parallel command
+ *
+ * `parallel [-j N] [-k] command [args ...] [::: item ...]`
+ *
+ * Each item replaces every {} in the arguments or is appended when no argument
+ * contains {}. Items are taken from the list after ::: or otherwise one per
+ * line from standard in. At most N workers run at once, defaulting to the
+ * number of online CPUs. With -k the output of each worker is collected in
+ * memory and printed in one piece in input order.
+ *
+ * @param args A NULL terminated array of strings starting with "parallel"
+ */
+void run_parallel(char** args);
+
+#endif
@@ -553,10 +553,37 @@ char *yytext;
 #include "memory_pool.h"
 #include "parse.tab.h"
 #include "parsing_interface.h"
+
+// Set when blanks were skipped after the last token
+static bool skipped_blank = false;
+
+// Set when blanks came right before the current token
+static bool blank_before = false;
+
+#define YY_USER_ACTION blank_before = skipped_blank; skipped_blank = false;
+
+// An equals sign is only part of the words it touches, as in key=value, key=
+// or =value. Standing apart it is a word of its own.
+static int equals_token() {
+  // yy_hold_char is the character after the equals sign
+  bool blank_after = strchr(" \t\r\n#<>=&|", yy_hold_char) != NULL;
+
+  if (!blank_before && !blank_after)
+    return EQUALS;
+
+  if (!blank_before)
+    return EQUALS_SUFFIX;
+
+  if (!blank_after)
+    return EQUALS_PREFIX;
+
+  yylval.str = memory_pool_strdup("=");
+  return SIM_STR;
+}
 #define YY_NO_INPUT 1
 /*string        ([a-zA-Z0-9\+\-\!@%\^\"\*.\{\}\[\]\(\)?\.,_~`/:;$]|\\(.|\n)|'(\\(.|\n)|[^\\'])*')+
 sim_str       [a-zA-Z0-9\+\-\!@%\^\"\*.\{\}\[\]\(\)?\.,_~`/:;]+*/
-#line 560 "src/parsing/lex.yy.c"
+#line 587 "src/parsing/lex.yy.c"
 
 #define INITIAL 0
 
@@ -772,10 +799,10 @@ YY_DECL
 		}
 
 	{
-#line 22 "src/parsing/parse.l"
+#line 49 "src/parsing/parse.l"
 
 
-#line 779 "src/parsing/lex.yy.c"
+#line 806 "src/parsing/lex.yy.c"
 
 	while ( /*CONSTCOND*/1 )		/* loops until end-of-file is reached */
 		{
@@ -844,121 +871,121 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 24 "src/parsing/parse.l"
+#line 51 "src/parsing/parse.l"
 { return PIPE;        }
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 25 "src/parsing/parse.l"
+#line 52 "src/parsing/parse.l"
 { return BCKGRND;     }
 	YY_BREAK
 case 3:
 YY_RULE_SETUP
-#line 26 "src/parsing/parse.l"
-{ return EQUALS;      }
+#line 53 "src/parsing/parse.l"
+{ return equals_token(); }
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 27 "src/parsing/parse.l"
+#line 54 "src/parsing/parse.l"
 { return REDIRIN;     }
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 28 "src/parsing/parse.l"
+#line 55 "src/parsing/parse.l"
 { return REDIROUT;    }
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 29 "src/parsing/parse.l"
+#line 56 "src/parsing/parse.l"
 { return REDIROUTAPP; }
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 30 "src/parsing/parse.l"
+#line 57 "src/parsing/parse.l"
 { return ECHO_TOK;    }
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 31 "src/parsing/parse.l"
+#line 58 "src/parsing/parse.l"
 { return EXPORT_TOK;  }
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 32 "src/parsing/parse.l"
+#line 59 "src/parsing/parse.l"
 { return CD_TOK;      }
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 33 "src/parsing/parse.l"
+#line 60 "src/parsing/parse.l"
 { return PWD_TOK;     }
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 34 "src/parsing/parse.l"
+#line 61 "src/parsing/parse.l"
 { return JOBS_TOK;    }
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 35 "src/parsing/parse.l"
+#line 62 "src/parsing/parse.l"
 { return KILL_TOK;    }
 	YY_BREAK
 case 13:
 /* rule 13 can match eol */
 YY_RULE_SETUP
-#line 36 "src/parsing/parse.l"
+#line 63 "src/parsing/parse.l"
 { return EOC_TOK;     }
 	YY_BREAK
 case YY_STATE_EOF(INITIAL):
-#line 37 "src/parsing/parse.l"
+#line 64 "src/parsing/parse.l"
 { return END;         }
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 38 "src/parsing/parse.l"
+#line 65 "src/parsing/parse.l"
 { yylval.str = memory_pool_strdup(yytext); return EXIT_TOK; }
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 40 "src/parsing/parse.l"
+#line 67 "src/parsing/parse.l"
 { yylval.str = memory_pool_strdup(yytext); return NUM;     }
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 41 "src/parsing/parse.l"
+#line 68 "src/parsing/parse.l"
 { yylval.str = memory_pool_strdup(yytext); return ID;      }
 	YY_BREAK
 case 17:
 YY_RULE_SETUP
-#line 42 "src/parsing/parse.l"
+#line 69 "src/parsing/parse.l"
 { yylval.str = memory_pool_strdup(yytext); return SIM_STR; }
 	YY_BREAK
 case 18:
 /* rule 18 can match eol */
 YY_RULE_SETUP
-#line 43 "src/parsing/parse.l"
+#line 70 "src/parsing/parse.l"
 { yylval.str = memory_pool_strdup(yytext); return STR;     }
 	YY_BREAK
 case 19:
 YY_RULE_SETUP
-#line 44 "src/parsing/parse.l"
+#line 71 "src/parsing/parse.l"
 { /* No action and no token */ }
 	YY_BREAK
 case 20:
 YY_RULE_SETUP
-#line 45 "src/parsing/parse.l"
-{ /* No action and no token */ }
+#line 72 "src/parsing/parse.l"
+{ skipped_blank = true; }
 	YY_BREAK
 case 21:
 YY_RULE_SETUP
-#line 47 "src/parsing/parse.l"
+#line 74 "src/parsing/parse.l"
 { fprintf(stderr, "LEX: Unexpected symbol: %c (Line: %d)\n", *yytext, yylineno); }
 	YY_BREAK
 case 22:
 YY_RULE_SETUP
-#line 49 "src/parsing/parse.l"
+#line 76 "src/parsing/parse.l"
 ECHO;
 	YY_BREAK
-#line 962 "src/parsing/lex.yy.c"
+#line 989 "src/parsing/lex.yy.c"
 
 	case YY_END_OF_BUFFER:
 		{
@@ -1928,7 +1955,7 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 49 "src/parsing/parse.l"
+#line 76 "src/parsing/parse.l"
 
 
 
@@ -1937,3 +1964,10 @@ void destroy_lex() {
     yylex_destroy();
 }
 
+// Read from a stream one line at a time like from a terminal, rather than
+// blocking until a full block of the script has arrived
+void set_lex_input(FILE* in) {
+  yyin = in;
+  yy_set_interactive(1);
+}
+
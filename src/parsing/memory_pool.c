@@ -1,6 +1,7 @@
 #include "memory_pool.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,17 @@ IMPLEMENT_DEQUE(MemoryPoolDeque, MemoryPool);
 
 static MemoryPoolDeque pool_deq = { NULL, 0, 0, 0, NULL };
 
+// The block allocations are currently served from. This is the back of
+// pool_deq. Its `next` pointer is only written back to the deque when the deque
+// itself changes so the common allocation path never touches the deque.
+static MemoryPool cur = { NULL, 0, NULL };
+
+// Smallest block the pool will shrink to when it is reset
+static size_t min_pool_size = 0;
+
+// Decaying high water mark of the bytes used by a single line
+static size_t high_water = 0;
+
 // Creates a single memory pool an returns a copy If the `size` parameter is
 // zero then this function will not allocate any space for later MemoryPool
 // allocations.
@@ -84,6 +96,9 @@ void initialize_memory_pool(size_t size) {
   if (size == 0)
     size = 1;
 
+  min_pool_size = size;
+  high_water = 0;
+
   pool_deq = new_destructable_MemoryPoolDeque(10, __destroy_memory_pool);
 
   MemoryPool pool = __initialize_memory_pool(size);
@@ -93,25 +108,48 @@ void initialize_memory_pool(size_t size) {
     pool = __low_memory_initialize_memory_pool(1, size);
 
   push_back_MemoryPoolDeque(&pool_deq, pool);
+  cur = pool;
 }
 
-void* memory_pool_alloc(size_t size) {
+// Round a pointer within a block up to a multiple of `align`
+static inline void* __align_up(void* ptr, size_t align) {
+  return (void*) (((uintptr_t) ptr + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+// Check if an aligned allocation fits in what is left of a block
+static inline bool __fits(MemoryPool pool, size_t size, size_t align) {
+  if (pool.pool == NULL)
+    return false;
+
+  char* start = __align_up(pool.next, align);
+
+  return start + size <= (char*) pool.pool + pool.size;
+}
+
+// Add blocks to the pool until one can hold the allocation
+static void* __memory_pool_alloc_slow(size_t size, size_t align) {
   assert(!is_empty_MemoryPoolDeque(&pool_deq));
 
-  MemoryPool pool = peek_back_MemoryPoolDeque(&pool_deq);
+  MemoryPool pool = cur;
   size_t init_size = peek_front_MemoryPoolDeque(&pool_deq).size;
 
+  // Blocks come from malloc() so only alignments stricter than what malloc()
+  // guarantees need extra room at the start of a new block
+  size_t required = size + ((align > MEMORY_POOL_ALIGN) ? align - 1 : 0);
+
+  update_back_MemoryPoolDeque(&pool_deq, cur);
+
   assert(pool.pool != NULL);
   assert(pool.size != 0);
   assert(pool.next != NULL);
 
-  while (pool.next - pool.pool + size > pool.size) {
+  while (!__fits(pool, size, align)) {
     // There is not enough room in the current memory pool to fit the
     // allocation. Create a new memory pool large enough to hold it. 
     size_t length_pool_deq = length_MemoryPoolDeque(&pool_deq);
     size_t new_pool_size = init_size * (2 << (length_pool_deq - 1));
 
-    if (new_pool_size < size) {
+    if (new_pool_size < required) {
       // The next pool size selected wasn't enough space. We have to have to add
       // something onto the deque since the new pool size is dependent on the
       // size of the deque.
@@ -123,25 +161,137 @@ void* memory_pool_alloc(size_t size) {
 
       if (pool.pool == NULL)
         // We are running low on memory. Try smaller allocations or exit Quash
-        pool = __low_memory_initialize_memory_pool(size, new_pool_size);
+        pool = __low_memory_initialize_memory_pool(required, new_pool_size);
     }
 
     push_back_MemoryPoolDeque(&pool_deq, pool);
   }
 
   assert(pool.next == peek_back_MemoryPoolDeque(&pool_deq).next);
-  void* ret = pool.next;
-  pool.next += size;
+  void* ret = __align_up(pool.next, align);
+  pool.next = (char*) ret + size;
 
   // Update record
-  update_back_MemoryPoolDeque(&pool_deq, pool);
+  cur = pool;
 
   return ret;
 }
 
+void* memory_pool_alloc_aligned(size_t size, size_t align) {
+  assert(cur.pool != NULL);
+  assert(align != 0 && (align & (align - 1)) == 0);
+
+  if (!__fits(cur, size, align))
+    return __memory_pool_alloc_slow(size, align);
+
+  void* ret = __align_up(cur.next, align);
+  cur.next = (char*) ret + size;
+
+  return ret;
+}
+
+void* memory_pool_alloc(size_t size) {
+  return memory_pool_alloc_aligned(size, MEMORY_POOL_ALIGN);
+}
+
+// Extend the most recent allocation without moving it
+bool memory_pool_grow(void* ptr, size_t old_size, size_t new_size) {
+  assert(cur.pool != NULL);
+  assert(new_size >= old_size);
+
+  if ((char*) ptr + old_size != (char*) cur.next)
+    return false;
+
+  if ((char*) ptr + new_size > (char*) cur.pool + cur.size)
+    return false;
+
+  cur.next = (char*) ptr + new_size;
+
+  return true;
+}
+
+// Round up to the next power of two
+static size_t __round_up_pow2(size_t size) {
+  size_t ret = 1;
+
+  while (ret < size)
+    ret <<= 1;
+
+  return ret;
+}
+
+// Rewind the pool for the next line while keeping its memory
+void reset_memory_pool() {
+  assert(!is_empty_MemoryPoolDeque(&pool_deq));
+
+  update_back_MemoryPoolDeque(&pool_deq, cur);
+
+  size_t used = 0;
+  size_t num_pools = length_MemoryPoolDeque(&pool_deq);
+  MemoryPool largest = peek_front_MemoryPoolDeque(&pool_deq);
+
+  // Find out how much this line needed and which block is worth keeping
+  for (size_t i = 0; i < num_pools; ++i) {
+    MemoryPool pool = pop_front_MemoryPoolDeque(&pool_deq);
+
+    used += pool.next - pool.pool;
+
+    if (pool.size > largest.size)
+      largest = pool;
+
+    push_back_MemoryPoolDeque(&pool_deq, pool);
+  }
+
+  // The high water mark decays by an eighth each line so a single huge line
+  // does not pin a huge block forever
+  high_water -= high_water >> 3;
+
+  if (used > high_water)
+    high_water = used;
+
+  size_t target = __round_up_pow2(high_water);
+
+  if (target < min_pool_size)
+    target = min_pool_size;
+
+  // Common case: one block that is neither too small for the lines being
+  // parsed nor holding onto far more memory than they need. Rewind it.
+  if (num_pools == 1 && largest.size >= target && largest.size <= 4 * target) {
+    cur.next = cur.pool;
+    return;
+  }
+
+  // The line spilled into extra blocks or the block grew much larger than
+  // recent lines need. Keep the largest block if it is a reasonable size and
+  // release everything else.
+  bool keep = largest.size >= target && largest.size <= 4 * target;
+
+  while (!is_empty_MemoryPoolDeque(&pool_deq)) {
+    MemoryPool pool = pop_front_MemoryPoolDeque(&pool_deq);
+
+    if (!keep || pool.pool != largest.pool)
+      __destroy_memory_pool(pool);
+  }
+
+  if (keep) {
+    largest.next = largest.pool;
+  }
+  else {
+    largest = __initialize_memory_pool(target);
+
+    if (largest.pool == NULL)
+      // We are running low on memory. Try smaller allocations or exit Quash
+      largest = __low_memory_initialize_memory_pool(1, target);
+  }
+
+  push_back_MemoryPoolDeque(&pool_deq, largest);
+  cur = largest;
+}
+
 // Free all memory contained in the MemoryPoolDeque
 void destroy_memory_pool() {
   destroy_MemoryPoolDeque(&pool_deq);
+  cur = (MemoryPool) { NULL, 0, NULL };
 }
 
 // Simple replacement for strdup() that uses the memory pool rather than malloc
@@ -149,7 +299,7 @@ char* memory_pool_strdup(const char* str) {
   assert(str != NULL);
 
   size_t len = strlen(str) + 1;
-  char* ret = memory_pool_alloc(len);
+  char* ret = memory_pool_alloc_aligned(len, 1);
 
   strcpy(ret, str);
 
@@ -20,10 +20,48 @@
 #ifndef SRC_PARSING_MEMORY_POOL_H
 #define SRC_PARSING_MEMORY_POOL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "deque.h"
 
+/**
+ * @def MEMORY_POOL_ALIGN
+ *
+ * @brief Alignment of allocations made with memory_pool_alloc(). This matches
+ * the guarantee malloc() makes.
+ */
+#define MEMORY_POOL_ALIGN (_Alignof(max_align_t))
+
+/**
+ * @def MEMORY_POOL_NEW(type)
+ *
+ * @brief Allocate space for one object of a type with the alignment the type
+ * requires
+ *
+ * @param type Type of the object
+ *
+ * @return A `type*` to uninitialized memory in the pool
+ */
+#define MEMORY_POOL_NEW(type)                                           \
+  ((type*) memory_pool_alloc_aligned(sizeof(type), _Alignof(type)))
+
+/**
+ * @def MEMORY_POOL_NEW_ARRAY(type, count)
+ *
+ * @brief Allocate space for an array of objects of a type with the alignment
+ * the type requires
+ *
+ * @param type Type of the elements
+ *
+ * @param count Number of elements
+ *
+ * @return A `type*` to uninitialized memory in the pool
+ */
+#define MEMORY_POOL_NEW_ARRAY(type, count)                              \
+  ((type*) memory_pool_alloc_aligned((count) * sizeof(type), _Alignof(type)))
+
 /**
  * @brief Allocate the memory pool
  *
@@ -44,6 +82,53 @@ void initialize_memory_pool(size_t size);
  */
 void* memory_pool_alloc(size_t size);
 
+/**
+ * @brief Reserve space in the memory pool starting at a multiple of `align`
+ *
+ * Strings and other byte buffers can pass an alignment of one so they do not
+ * waste space on padding.
+ *
+ * @param size Size in bytes of the requested reserved space
+ *
+ * @param align Required alignment of the returned address. Must be a power of
+ * two.
+ *
+ * @return A pointer to a unique array of size bytes
+ *
+ * @sa MEMORY_POOL_NEW, MEMORY_POOL_NEW_ARRAY
+ */
+void* memory_pool_alloc_aligned(size_t size, size_t align);
+
+/**
+ * @brief Try to extend an allocation in place
+ *
+ * This only succeeds when `ptr` is the most recent allocation from the pool and
+ * the block it lives in has room for the extra bytes.
+ *
+ * @param ptr The allocation to extend
+ *
+ * @param old_size Current size of the allocation in bytes
+ *
+ * @param new_size Requested size of the allocation in bytes
+ *
+ * @return True if the allocation now holds `new_size` bytes. On false nothing
+ * changed and the caller has to allocate and copy.
+ */
+bool memory_pool_grow(void* ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Invalidate every allocation in the memory pool while keeping its
+ * memory for reuse
+ *
+ * The pool remembers a decaying high water mark of how much memory each cycle
+ * between resets used. If the allocations since the last reset fit in a single
+ * block of a suitable size, that block is simply rewound. Otherwise the pool is
+ * consolidated into one block sized from the high water mark. A block that has
+ * become much larger than recent cycles need is released and replaced with a
+ * smaller one.
+ */
+void reset_memory_pool();
+
 /**
  * @brief Free all memory allocated in the memory pool
  */
@@ -83,7 +168,7 @@ char* memory_pool_strdup(const char* str);
     else                                                                \
       ret.cap = 1;                                                      \
                                                                         \
-    ret.data = (type*) memory_pool_alloc(ret.cap * sizeof(type));       \
+    ret.data = MEMORY_POOL_NEW_ARRAY(type, ret.cap);                    \
                                                                         \
     if (ret.data == NULL) {                                             \
       fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
@@ -148,7 +233,7 @@ char* memory_pool_strdup(const char* str);
       type* old_data = deq->data;                                       \
       size_t len = length_##struct_name(deq);                           \
                                                                         \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
+      deq->data = MEMORY_POOL_NEW_ARRAY(type, deq->cap);                \
                                                                         \
       if (deq->data == NULL) {                                          \
         fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
@@ -199,8 +284,25 @@ char* memory_pool_strdup(const char* str);
       type* old_data = deq->data;                                       \
       size_t old_cap = deq->cap;                                        \
                                                                         \
+      /* When the deque owns the last allocation in the pool it can   */\
+      /* double in place. Elements that wrapped around to the start   */\
+      /* of the buffer are moved to just past the old end.            */\
+      if (memory_pool_grow(deq->data, old_cap * sizeof(type),           \
+                           2 * old_cap * sizeof(type))) {               \
+        deq->cap = 2 * old_cap;                                         \
+                                                                        \
+        if (deq->back < deq->front) {                                   \
+          for (size_t i = 0; i < deq->back; ++i)                        \
+            deq->data[old_cap + i] = deq->data[i];                      \
+                                                                        \
+          deq->back += old_cap;                                         \
+        }                                                               \
+                                                                        \
+        return;                                                         \
+      }                                                                 \
+                                                                        \
       deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
+      deq->data = MEMORY_POOL_NEW_ARRAY(type, deq->cap);                \
                                                                         \
       if (deq->data == NULL) {                                          \
         fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
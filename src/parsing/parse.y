@@ -42,12 +42,12 @@ int yyerrstatus = 0;
 %parse-param { CommandHolder** __ret_cmds }
 
 /* Terminals */
-%token PIPE BCKGRND SQUOTE EQUALS REDIRIN REDIROUT REDIROUTAPP END
+%token PIPE BCKGRND SQUOTE EQUALS EQUALS_SUFFIX EQUALS_PREFIX REDIRIN REDIROUT REDIROUTAPP END
 %token ECHO_TOK EXPORT_TOK CD_TOK PWD_TOK JOBS_TOK KILL_TOK EOC_TOK
 %token <str> STR SIM_STR ID NUM EXIT_TOK
 
 /* Non-terminals */
-%type <str> string first_string special_string
+%type <str> argument string first_string special_string
 %type <integer> cmd_bg redir_mark
 %type <redirect> redir redir_inner
 %type <holder> cmd_top
@@ -164,14 +164,22 @@ cmd_content: cmd {
   $$ = mk_pwd_command();
 }
 |       JOBS_TOK {
-  $$ = mk_jobs_command();
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_jobs_command(cmd);
+}
+|       JOBS_TOK cmd_arguments {
+  $$ = mk_jobs_command(as_array_CmdStrs(&$2, NULL));
 }
 |       EXIT_TOK {
   $$ = mk_exit_command();
 }
-|       KILL_TOK NUM NUM {
+|       KILL_TOK string string {
   $$ = mk_kill_command($2, $3);
 }
+|       KILL_TOK string {
+  $$ = mk_kill_command(NULL, $2);
+}
 
 redir: redir_inner {
   $$ = $1;
@@ -251,7 +259,7 @@ cmd:    first_string cmd_arguments {
 
 
 
-cmd_arguments: string {
+cmd_arguments: argument {
   CmdStrs args = new_CmdStrs(1);
 
   push_front_CmdStrs(&args, $1);
@@ -259,7 +267,7 @@ cmd_arguments: string {
 
   $$ = args;
 }
-|       string cmd_arguments {
+|       argument cmd_arguments {
   push_front_CmdStrs(&$2, $1);
 
   $$ = $2;
@@ -267,6 +275,44 @@ cmd_arguments: string {
 
 
 
+argument: string {
+  $$ = $1;
+}
+|       argument EQUALS string {
+  // The lexer splits key=value arguments at the equals sign. It only returns
+  // EQUALS when no blank separates the pieces.
+  size_t klen = strlen($1);
+  size_t vlen = strlen($3);
+  char* arg = memory_pool_alloc(klen + vlen + 2);
+
+  memcpy(arg, $1, klen);
+  arg[klen] = '=';
+  memcpy(arg + klen + 1, $3, vlen + 1);
+
+  $$ = arg;
+}
+|       argument EQUALS_SUFFIX {
+  size_t klen = strlen($1);
+  char* arg = memory_pool_alloc(klen + 2);
+
+  memcpy(arg, $1, klen);
+  arg[klen] = '=';
+  arg[klen + 1] = '\0';
+
+  $$ = arg;
+}
+|       EQUALS_PREFIX string {
+  size_t vlen = strlen($2);
+  char* arg = memory_pool_alloc(vlen + 2);
+
+  arg[0] = '=';
+  memcpy(arg + 1, $2, vlen + 1);
+
+  $$ = arg;
+}
+
+
+
 string: first_string {
   $$ = $1;
 }
@@ -2,96 +2,90 @@
 
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory_pool.h"
 #include "parse.tab.h"
 
-IMPLEMENT_DEQUE_STRUCT(SizeStack, size_t);
-IMPLEMENT_DEQUE_STRUCT(StrBuilder, char);
-IMPLEMENT_DEQUE_STRUCT(MPStrBuilder, char);
-
-IMPLEMENT_DEQUE(SizeStack, size_t);
-IMPLEMENT_DEQUE(StrBuilder, char);
-IMPLEMENT_DEQUE_MEMORY_POOL(MPStrBuilder, char);
 IMPLEMENT_DEQUE_MEMORY_POOL(CmdStrs, char*);
 IMPLEMENT_DEQUE_MEMORY_POOL(Cmds, CommandHolder);
 
 extern void destroy_lex();
+extern void set_lex_input(FILE* in);
+
+/**
+ * @brief Writes the words of a command string
+ *
+ * The words are written twice: once without a buffer to find the exact length
+ * and once more into a buffer of that length.
+ */
+typedef struct CmdWriter {
+  char* buf;  /**< Buffer to write to or NULL to only count */
+  size_t len; /**< Length of the words written so far */
+} CmdWriter;
+
+// Write a word followed by a space
+static void __write_word(CmdWriter* w, const char* word) {
+  size_t len = strlen(word);
+
+  if (w->buf != NULL) {
+    memcpy(w->buf + w->len, word, len);
+    w->buf[w->len + len] = ' ';
+  }
 
-// Generate a string based off of a pipable generic command
-static inline void __stringify_generic_cmd(GenericCommand cmd, CmdStrs* strs) {
-  // Extract argument strings
-  for (size_t i = 0; cmd.args[i] != NULL; ++i)
-    push_back_CmdStrs(strs, cmd.args[i]);
-}
-
-static inline void __stringify_echo_cmd(EchoCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("echo"));
-
-  // Extract argument strings
-  for (size_t i = 0; cmd.args[i] != NULL; ++i)
-    push_back_CmdStrs(strs, cmd.args[i]);
-}
-
-// Generate a string based off the export command
-static void __stringify_export_cmd(ExportCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("export"));
-  push_back_CmdStrs(strs, cmd.env_var);
-  push_back_CmdStrs(strs, cmd.val);
-}
-
-// Generate a string based off of the cd command
-static void __stringify_cd_cmd(CDCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("cd"));
-  push_back_CmdStrs(strs, cmd.dir);
-}
-
-// Generate a string based off of the kill command
-static void __stringify_kill_cmd(KillCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("kill"));
-  push_back_CmdStrs(strs, cmd.sig_str);
-  push_back_CmdStrs(strs, cmd.job_str);
+  w->len += len + 1;
 }
 
-// Generate a string based off the a variant of a simple command
-static void __stringify_simple_cmd(const char* str, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup(str));
+// Write the words of a NULL terminated argument array
+static void __write_args(CmdWriter* w, char** args) {
+  for (size_t i = 0; args[i] != NULL; ++i)
+    __write_word(w, args[i]);
 }
 
-// Entry point for turning a command into a string
-static void __stringify_command(Command cmd, CmdStrs* strs) {
+// Entry point for turning a command into words
+static void __write_command(CmdWriter* w, Command cmd) {
   switch (get_command_type(cmd)) {
   case GENERIC:
-    __stringify_generic_cmd(cmd.generic, strs);
+    __write_args(w, cmd.generic.args);
     break;
 
   case ECHO:
-    __stringify_echo_cmd(cmd.echo, strs);
+    __write_word(w, "echo");
+    __write_args(w, cmd.echo.args);
     break;
 
   case EXPORT:
-    __stringify_export_cmd(cmd.export, strs);
+    __write_word(w, "export");
+    __write_word(w, cmd.export.env_var);
+    __write_word(w, cmd.export.val);
     break;
 
   case CD:
-    __stringify_cd_cmd(cmd.cd, strs);
+    __write_word(w, "cd");
+    __write_word(w, cmd.cd.dir);
     break;
 
   case KILL:
-    __stringify_kill_cmd(cmd.kill, strs);
+    __write_word(w, "kill");
+
+    if (cmd.kill.sig_str != NULL)
+      __write_word(w, cmd.kill.sig_str);
+
+    __write_word(w, cmd.kill.job_str);
     break;
 
   case PWD:
-    __stringify_simple_cmd("PWD", strs);
+    __write_word(w, "PWD");
     break;
 
   case JOBS:
-    __stringify_simple_cmd("JOBS", strs);
+    __write_word(w, "JOBS");
+    __write_args(w, cmd.jobs.args);
     break;
 
   case EXIT:
-    __stringify_simple_cmd("EXIT", strs);
+    __write_word(w, "EXIT");
     break;
 
   default:
@@ -99,70 +93,85 @@ static void __stringify_command(Command cmd, CmdStrs* strs) {
   }
 }
 
-static void __stringify_holder(CommandHolder holder, CmdStrs* strs) {
-  __stringify_command(holder.cmd, strs);
+static void __write_holder(CmdWriter* w, const CommandHolder* holder) {
+  __write_command(w, holder->cmd);
 
   // Generate redirect symbols and extract file names
-  if (holder.flags & REDIRECT_IN) {
-    push_back_CmdStrs(strs, memory_pool_strdup("<"));
-    push_back_CmdStrs(strs, holder.redirect_in);
+  if (holder->flags & REDIRECT_IN) {
+    __write_word(w, "<");
+    __write_word(w, holder->redirect_in);
   }
 
-  if (holder.flags & REDIRECT_APPEND)
-    push_back_CmdStrs(strs, memory_pool_strdup(">>"));
-  else if (holder.flags & REDIRECT_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup(">"));
+  if (holder->flags & REDIRECT_APPEND)
+    __write_word(w, ">>");
+  else if (holder->flags & REDIRECT_OUT)
+    __write_word(w, ">");
 
-  if (holder.flags & REDIRECT_OUT)
-    push_back_CmdStrs(strs, holder.redirect_out);
+  if (holder->flags & REDIRECT_OUT)
+    __write_word(w, holder->redirect_out);
 
   // Generate the pipe symbol
-  if (holder.flags & PIPE_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup("|"));
+  if (holder->flags & PIPE_OUT)
+    __write_word(w, "|");
 }
 
-// Create an array of strings representing the command returned from the parser
-static void __stringify_script(const CommandHolder* holders, CmdStrs* strs) {
-  assert(holders != NULL);
-  assert(strs != NULL);
+static void __write_script(CmdWriter* w, const CommandHolder* holders) {
+  for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
+    __write_holder(w, &holders[i]);
 
-  if (holders != NULL) {
-    for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
-      __stringify_holder(holders[i], strs);
+  if (holders[0].flags & BACKGROUND)
+    __write_word(w, "&");
+}
 
-    if (holders[0].flags & BACKGROUND)
-      push_back_CmdStrs(strs, memory_pool_strdup("&"));
-  }
+// Build the string of a script with each word followed by a space
+char* stringify_script(const CommandHolder* holders) {
+  assert(holders != NULL);
 
-  push_back_CmdStrs(strs, NULL);
-}
+  CmdWriter w = { NULL, 0 };
 
-// Concatenates arrays of strings together to form a single string with each
-// string separated by a space.
-static char* __condense_string_array(char** str_arr) {
-  SizeStack ss = new_SizeStack(10);
-  size_t len = 0;
+  __write_script(&w, holders);
 
-  for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    size_t size = strlen(str_arr[i]) + 1;
+  w.buf = malloc(w.len + 1);
+  w.len = 0;
 
-    push_back_SizeStack(&ss, size);
-    len += size;
-  }
+  __write_script(&w, holders);
+  w.buf[w.len] = '\0';
 
-  char* ret = (char*) memory_pool_alloc(len + 1);
-  size_t pos = 0;
+  return w.buf;
+}
 
-  for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    strcpy(ret + pos, str_arr[i]);
-    pos += pop_front_SizeStack(&ss);
-    ret[pos - 1] = ' ';
-  }
+/**
+ * @brief A string growing at the end of the memory pool
+ *
+ * While it is the most recent allocation it grows in place. Otherwise it is
+ * copied to a larger allocation.
+ */
+typedef struct PoolStr {
+  char* buf;  /**< The characters in the memory pool */
+  size_t len; /**< Number of characters written */
+  size_t cap; /**< Size of the allocation */
+} PoolStr;
+
+// Append a run of characters to a string
+static void __append(PoolStr* s, const char* src, size_t n) {
+  if (s->len + n > s->cap) {
+    size_t cap = 2 * s->cap;
+
+    if (cap < s->len + n)
+      cap = s->len + n;
+
+    if (!memory_pool_grow(s->buf, s->cap, cap)) {
+      char* buf = memory_pool_alloc_aligned(cap, 1);
+
+      memcpy(buf, s->buf, s->len);
+      s->buf = buf;
+    }
 
-  ret[pos] = '\0';
-  destroy_SizeStack(&ss);
+    s->cap = cap;
+  }
 
-  return ret;
+  memcpy(s->buf + s->len, src, n);
+  s->len += n;
 }
 
 // Helper for __interpret_deref: Checks if the character is a valid first
@@ -177,41 +186,48 @@ static inline bool __is_identifier_char(char c) {
   return isalnum(c) || c == '_';
 }
 
-// Expand an environment variable onto a string
-static void __interpret_deref(MPStrBuilder* bld, const char* str, int* idx) {
-  assert(str != NULL);
-  assert(str[*idx] == '$');
-  assert(peek_back_MPStrBuilder(bld) == '$');
-
-  // Remove the dereference symbol at the back of the bld deque
-  pop_back_MPStrBuilder(bld);
+// Checks if a backslash outside of quotes escapes the character
+static inline bool __is_escapable_char(char c) {
+  switch (c) {
+  case '\\':
+  case '\'':
+  case '#':
+  case '$':
+  case '=':
+  case '&':
+  case '|':
+  case ';':
+  case ' ':
+  case '\t':
+    return true;
 
-  StrBuilder tmp = new_StrBuilder(16);
-  char c;
+  default:
+    return false;
+  }
+}
 
-  // Extract the identifier characters. Since this is intended only as a helper
-  // function we assume that interpret_complex_string token has already noticed
-  // a valid first identifier character after the dereference symbol.
-  while (__is_identifier_char((c = str[++(*idx)])))
-    push_back_StrBuilder(&tmp, c);
+// Expand an environment variable onto a string. Returns the position after its
+// name.
+static const char* __interpret_deref(PoolStr* out, const char* str) {
+  assert(str != NULL);
+  assert(*str == '$');
 
-  // idx increments one too far in the while loop so bring it back down
-  --(*idx);
+  // Since this is intended only as a helper function we assume that
+  // interpret_complex_string_token has already noticed a valid first
+  // identifier character after the dereference symbol.
+  const char* id = str + 1;
+  const char* end = id + 1;
 
-  // Add the null terminator to the string
-  push_back_StrBuilder(&tmp, '\0');
+  while (__is_identifier_char(*end))
+    ++end;
 
-  // Extract the id string and lookup the environment variable
-  char* id = as_array_StrBuilder(&tmp, NULL);
-  const char* env_var = lookup_env(id);
+  // The name is looked up in place rather than copied out of the token
+  const char* env_var = lookup_env_len(id, end - id);
 
-  free(id);
+  if (env_var != NULL)
+    __append(out, env_var, strlen(env_var));
 
-  // Append env_var to the string builder
-  if (env_var != NULL) {
-    for (int i = 0; env_var[i] != '\0'; ++i)
-      push_back_MPStrBuilder(bld, env_var[i]);
-  }
+  return end;
 }
 
 // Cleans up escapes and unescaped single quotes and expands environment
@@ -219,67 +235,61 @@ static void __interpret_deref(MPStrBuilder* bld, const char* str, int* idx) {
 char* interpret_complex_string_token(const char* str) {
   assert(str != NULL);
 
-  MPStrBuilder bld = new_MPStrBuilder(64);
-  int i;
-  int len = strlen(str);
+  size_t len = strlen(str);
+
+  // Only expansions make the result longer than the token
+  PoolStr out = { memory_pool_alloc_aligned(len + 1, 1), 0, len + 1 };
   bool in_quotes = false;
 
-  for (i = 0; i <= len; ++i) {
-    push_back_MPStrBuilder(&bld, str[i]);
+  while (true) {
+    // Copy everything up to the next character that needs a closer look in
+    // one go. Variables are not expanded inside quotes.
+    size_t span = strcspn(str, in_quotes ? "\\'" : "\\'$");
+
+    __append(&out, str, span);
+    str += span;
 
-    switch (str[i]) {
+    if (*str == '\0')
+      break;
+
+    switch (*str) {
     case '\\':                // Remove valid escape characters
-      if (!in_quotes) {
-        switch (str[i+1]) {
-        case '\\':
-        case '\'':
-        case '#':
-        case '$':
-        case '=':
-        case '&':
-        case '|':
-        case ';':
-        case ' ':
-        case '\t':
-          update_back_MPStrBuilder(&bld, str[++i]);
-          break;
-
-        case '\n':
-          pop_back_MPStrBuilder(&bld);
-          ++i;
-          break;
-
-        default:
-          break;
-        }
+      if (!in_quotes && __is_escapable_char(str[1])) {
+        __append(&out, str + 1, 1);
+        str += 2;
+      }
+      else if (!in_quotes && str[1] == '\n') {
+        str += 2;
       }
-      else if (str[i+1] == '\'') {
-        update_back_MPStrBuilder(&bld, '\'');
-        ++i;
+      else if (in_quotes && str[1] == '\'') {
+        __append(&out, "'", 1);
+        str += 2;
+      }
+      else {
+        __append(&out, str++, 1);
       }
       break;
 
     case '\'':                // Remove single quotes and toggle quote state
       in_quotes = !in_quotes;
-      pop_back_MPStrBuilder(&bld);
+      ++str;
       break;
 
     case '$':                 // Try to dereference environment variables
-      if (!in_quotes && __is_first_identifier_char(str[i + 1]))
-        __interpret_deref(&bld, str, &i);
-      break;
-
-    default:
+      if (__is_first_identifier_char(str[1]))
+        str = __interpret_deref(&out, str);
+      else
+        __append(&out, str++, 1);
       break;
     }
   }
 
   // Add a null terminator
-  update_back_MPStrBuilder(&bld, '\0');
+  __append(&out, "", 1);
 
   assert(!in_quotes);
 
-  return as_array_MPStrBuilder(&bld, NULL);
+  return out.buf;
 }
 
 // Build a Redirect structure
@@ -299,11 +309,11 @@ CommandHolder* parse(QuashState* state) {
 
   yyparse(&holders);
 
-  if (holders != NULL) {
-    CmdStrs strs = new_CmdStrs(10);
-    __stringify_script(holders, &strs);
-    state->parsed_str = __condense_string_array(as_array_CmdStrs(&strs, NULL));
-  }
+  // The command string is only built if a job needs it
+  state->script = holders;
+
+  if (holders != NULL)
+    state->first = holders[0];
 
   return holders;
 }
@@ -312,3 +322,8 @@ CommandHolder* parse(QuashState* state) {
 void destroy_parser() {
   destroy_lex();
 }
+
+// Choose the stream the parser reads from
+void set_parser_input(FILE* in) {
+  set_lex_input(in);
+}
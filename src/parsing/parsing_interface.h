@@ -87,11 +87,11 @@ char* interpret_complex_string_token(const char* str);
  * Functions used by the parser
  *************************************************************/
 /**
- * @brief Handles the call to the parser and provides a string equivalent of the
- * @a Command structure to @a QuashState
+ * @brief Handles the call to the parser and keeps the parsed script in @a
+ * QuashState so a string equivalent can be built from it later
  *
- * @param[out] state The state of the quash shell. The parsed_str member of
- * QuashState is set to the stringified command structure.
+ * @param[out] state The state of the quash shell. The script and first members
+ * of QuashState are set to the parsed script and a copy of its first stage.
  *
  * @return A pointer to the parsed command structure
  *
@@ -99,9 +99,30 @@ char* interpret_complex_string_token(const char* str);
  */
 CommandHolder* parse(QuashState* state);
 
+/**
+ * @brief Build a string equivalent of a script
+ *
+ * Each word of the script is followed by a space. The length is counted before
+ * the string is written, so it is allocated exactly once.
+ *
+ * @note The free function must be called on the result eventually
+ *
+ * @param holders The script
+ *
+ * @return The command string
+ */
+char* stringify_script(const CommandHolder* holders);
+
 /**
  * @brief Cleanup memory dynamically allocated by the parser
  */
 void destroy_parser();
 
+/**
+ * @brief Choose the stream the parser reads scripts from
+ *
+ * @param in Stream to read from. Standard in is used until this is called.
+ */
+void set_parser_input(FILE* in);
+
 #endif
@@ -0,0 +1,278 @@
+/**
+ * @file path_cache.c
+ *
+ * @brief Implements the PATH resolution cache as an open addressing hash table
+ */
+
+#include "path_cache.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+/**
+ * @brief A command name and the location it was resolved to
+ */
+typedef struct PathEntry {
+  char* name;   /**< Command name used as the key. NULL marks an empty slot */
+  char* path;   /**< Full path to the executable */
+  size_t dir;   /**< Index of the PATH directory the executable was found in */
+  size_t hits;  /**< Number of times this entry satisfied a lookup */
+} PathEntry;
+
+/**
+ * @brief A directory listed in PATH and the state it was in when searched
+ */
+typedef struct PathDir {
+  char* dir;          /**< Directory name */
+  struct timespec mtime; /**< Modification time when PATH was last split */
+} PathDir;
+
+static PathEntry* table = NULL;
+static size_t table_cap = 0;
+static size_t table_len = 0;
+
+static char* path_str = NULL;
+static PathDir* dirs = NULL;
+static size_t num_dirs = 0;
+
+// FNV-1a hash of a command name
+static size_t __hash(const char* str) {
+  uint64_t h = 1469598103934665603ULL;
+
+  for (; *str != '\0'; ++str)
+    h = (h ^ (unsigned char) *str) * 1099511628211ULL;
+
+  return (size_t) h;
+}
+
+// Read the modification time of a directory. Missing directories read as zero.
+static struct timespec __dir_mtime(const char* dir) {
+  struct stat st;
+
+  if (stat(dir, &st) != 0)
+    return (struct timespec) { 0, 0 };
+
+  return st.st_mtim;
+}
+
+static bool __same_time(struct timespec a, struct timespec b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Free the table entries leaving the table itself allocated
+static void __clear_entries() {
+  for (size_t i = 0; i < table_cap; ++i) {
+    free(table[i].name);
+    free(table[i].path);
+    table[i] = (PathEntry) { NULL, NULL, 0, 0 };
+  }
+
+  table_len = 0;
+}
+
+static void __clear_dirs() {
+  for (size_t i = 0; i < num_dirs; ++i)
+    free(dirs[i].dir);
+
+  free(dirs);
+  free(path_str);
+
+  dirs = NULL;
+  num_dirs = 0;
+  path_str = NULL;
+}
+
+// Split PATH into its directories and record their modification times
+static void __load_dirs(const char* path) {
+  __clear_dirs();
+
+  path_str = strdup(path);
+  num_dirs = 1;
+
+  for (const char* c = path; *c != '\0'; ++c)
+    if (*c == ':')
+      ++num_dirs;
+
+  dirs = malloc(num_dirs * sizeof(PathDir));
+
+  const char* start = path;
+
+  for (size_t i = 0; i < num_dirs; ++i) {
+    const char* end = strchr(start, ':');
+
+    if (end == NULL)
+      end = start + strlen(start);
+
+    // An empty PATH element names the current directory
+    dirs[i].dir = (end == start) ? strdup(".") : strndup(start, end - start);
+    dirs[i].mtime = __dir_mtime(dirs[i].dir);
+
+    start = end + 1;
+  }
+}
+
+// Make sure the directory list matches the current PATH. Returns false if the
+// cache had to be dropped.
+static bool __sync_path() {
+  const char* path = lookup_env("PATH");
+
+  if (path == NULL)
+    path = "";
+
+  if (path_str != NULL && strcmp(path, path_str) == 0)
+    return true;
+
+  __clear_entries();
+  __load_dirs(path);
+
+  return false;
+}
+
+// Check that no directory up to and including `dir` has changed since the
+// cache was filled. A change to an earlier directory may mean a new executable
+// now shadows the cached one.
+static bool __dirs_unchanged(size_t dir) {
+  for (size_t i = 0; i <= dir && i < num_dirs; ++i)
+    if (!__same_time(dirs[i].mtime, __dir_mtime(dirs[i].dir)))
+      return false;
+
+  return true;
+}
+
+static PathEntry* __find_slot(const char* name) {
+  size_t mask = table_cap - 1;
+  size_t i = __hash(name) & mask;
+
+  while (table[i].name != NULL && strcmp(table[i].name, name) != 0)
+    i = (i + 1) & mask;
+
+  return &table[i];
+}
+
+// Double the capacity of the table and reinsert every entry
+static void __grow_table() {
+  PathEntry* old = table;
+  size_t old_cap = table_cap;
+
+  table_cap = (table_cap == 0) ? 64 : 2 * table_cap;
+  table = calloc(table_cap, sizeof(PathEntry));
+
+  for (size_t i = 0; i < old_cap; ++i)
+    if (old[i].name != NULL)
+      *__find_slot(old[i].name) = old[i];
+
+  free(old);
+}
+
+// Search the PATH directories for an executable regular file
+static char* __search_dirs(const char* name, size_t* dir) {
+  size_t name_len = strlen(name);
+
+  for (size_t i = 0; i < num_dirs; ++i) {
+    size_t dir_len = strlen(dirs[i].dir);
+    char* candidate = malloc(dir_len + name_len + 2);
+    struct stat st;
+
+    memcpy(candidate, dirs[i].dir, dir_len);
+    candidate[dir_len] = '/';
+    memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+    if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+        access(candidate, X_OK) == 0) {
+      *dir = i;
+      return candidate;
+    }
+
+    free(candidate);
+  }
+
+  return NULL;
+}
+
+// Look a command name up in the table, searching PATH on a miss
+static const char* __resolve(const char* name, size_t hit) {
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  if (*name == '\0')
+    return NULL;
+
+  if (table_cap == 0)
+    __grow_table();
+
+  if (__sync_path()) {
+    PathEntry* entry = __find_slot(name);
+
+    if (entry->name != NULL) {
+      if (__dirs_unchanged(entry->dir)) {
+        entry->hits += hit;
+        return entry->path;
+      }
+
+      // Something in PATH changed. Start over with fresh modification times.
+      path_cache_clear();
+      __sync_path();
+    }
+  }
+
+  size_t dir;
+  char* path = __search_dirs(name, &dir);
+
+  if (path == NULL)
+    return NULL;
+
+  if (4 * (table_len + 1) > 3 * table_cap)
+    __grow_table();
+
+  PathEntry* entry = __find_slot(name);
+
+  *entry = (PathEntry) { strdup(name), path, dir, hit };
+  ++table_len;
+
+  return path;
+}
+
+// Resolve a command name to an executable path
+const char* path_cache_lookup(const char* name) {
+  return __resolve(name, 1);
+}
+
+// Resolve a command name without counting it as a use
+bool path_cache_prime(const char* name) {
+  return strchr(name, '/') == NULL && __resolve(name, 0) != NULL;
+}
+
+// Forget every cached location
+void path_cache_clear() {
+  __clear_entries();
+  __clear_dirs();
+}
+
+// Print the cache in the same layout as the hash builtin of bash
+void path_cache_print(FILE* out) {
+  if (table_len == 0) {
+    fprintf(out, "hash: hash table empty\n");
+    return;
+  }
+
+  fprintf(out, "hits\tcommand\n");
+
+  for (size_t i = 0; i < table_cap; ++i)
+    if (table[i].name != NULL)
+      fprintf(out, "%4zu\t%s\n", table[i].hits, table[i].path);
+}
+
+// Release the table
+void destroy_path_cache() {
+  path_cache_clear();
+  free(table);
+
+  table = NULL;
+  table_cap = 0;
+}
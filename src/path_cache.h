@@ -0,0 +1,60 @@
+/**
+ * @file path_cache.h
+ *
+ * @brief Cache of executables resolved through the PATH environment variable.
+ *
+ * Resolving a command name by letting exec walk PATH costs one failed execve()
+ * per directory preceding the one that holds the executable, and that walk
+ * happens in the child after the process has already been created. This cache
+ * remembers where each command name was found so quash can resolve it before
+ * creating a process. Entries are dropped when PATH changes or when the
+ * modification time of a searched directory changes.
+ */
+
+#ifndef SRC_PATH_CACHE_H
+#define SRC_PATH_CACHE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Resolve a command name to the path of an executable
+ *
+ * Names containing a '/' are returned unchanged and are never cached.
+ *
+ * @param name Name of the command to resolve
+ *
+ * @return The path of the executable or NULL if it can not be found. The
+ * string is owned by the cache and is only valid until the next call to a
+ * path_cache function.
+ */
+const char* path_cache_lookup(const char* name);
+
+/**
+ * @brief Resolve a command name and add it to the cache without counting it as
+ * a use of the command
+ *
+ * @param name Name of the command to resolve
+ *
+ * @return True if the command was found in PATH
+ */
+bool path_cache_prime(const char* name);
+
+/**
+ * @brief Drop every entry in the cache
+ */
+void path_cache_clear();
+
+/**
+ * @brief Print the hit count and location of each cached command
+ *
+ * @param out Stream to print the table to
+ */
+void path_cache_print(FILE* out);
+
+/**
+ * @brief Free all memory held by the cache
+ */
+void destroy_path_cache();
+
+#endif
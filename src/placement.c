@@ -0,0 +1,233 @@
+/**
+ * @file placement.c
+ *
+ * @brief Implements CPU affinity and NUMA memory placement of jobs
+ */
+
+#define _GNU_SOURCE // for cpu_set_t
+
+#include "placement.h"
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Largest number of NUMA nodes a memory policy can name
+#define MAX_NODES 1024
+
+// Bits in one word of a node mask
+#define NODE_WORD_BITS (8 * sizeof(unsigned long))
+
+// The C library has no wrapper for set_mempolicy() without libnuma
+static int __set_mempolicy(int mode, const unsigned long* mask,
+                           unsigned long max_node) {
+#ifdef SYS_set_mempolicy
+  return syscall(SYS_set_mempolicy, mode, mask, max_node);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Parse a list such as 0-7,16 into a set. Returns false if it is malformed.
+static bool __parse_list(const char* list, cpu_set_t* set) {
+  const char* c = list;
+
+  CPU_ZERO(set);
+
+  while (true) {
+    char* end;
+
+    if (*c < '0' || *c > '9')
+      return false;
+
+    long first = strtol(c, &end, 10);
+    long last = first;
+
+    if (*end == '-') {
+      c = end + 1;
+
+      if (*c < '0' || *c > '9')
+        return false;
+
+      last = strtol(c, &end, 10);
+    }
+
+    if (last < first || last >= CPU_SETSIZE)
+      return false;
+
+    for (long i = first; i <= last; ++i)
+      CPU_SET(i, set);
+
+    // Lists read from sysfs end in a newline
+    if (*end == '\0' || strcmp(end, "\n") == 0)
+      return true;
+
+    if (*end != ',')
+      return false;
+
+    c = end + 1;
+  }
+}
+
+// Read a list from a file in sysfs
+static bool __read_list(const char* path, cpu_set_t* set) {
+  char buf[4096];
+  FILE* file = fopen(path, "r");
+
+  if (file == NULL)
+    return false;
+
+  bool ok = fgets(buf, sizeof(buf), file) != NULL && __parse_list(buf, set);
+
+  fclose(file);
+
+  return ok;
+}
+
+// Get the n-th member of a set or -1
+static int __nth_member(const cpu_set_t* set, int n) {
+  for (int i = 0; i < CPU_SETSIZE; ++i)
+    if (CPU_ISSET(i, set) && n-- == 0)
+      return i;
+
+  return -1;
+}
+
+// Create a placement that changes nothing
+Placement new_placement() {
+  Placement place;
+
+  CPU_ZERO(&place.cpus);
+  place.has_cpus = false;
+  place.node = -1;
+
+  return place;
+}
+
+// Add one specification to a placement
+bool parse_placement(Placement* place, const char* spec) {
+  cpu_set_t set;
+  int node = place->node;
+
+  if (strncmp(spec, "cpus=", 5) == 0) {
+    if (!__parse_list(spec + 5, &set))
+      return false;
+  }
+  else if (strncmp(spec, "node=", 5) == 0) {
+    char path[64];
+    char* end;
+    long n = strtol(spec + 5, &end, 10);
+
+    if (spec[5] == '\0' || *end != '\0' || n < 0 || n >= MAX_NODES)
+      return false;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", n);
+
+    // Nodes that only provide memory have an empty list and no CPU to run on
+    if (!__read_list(path, &set))
+      return false;
+
+    node = n;
+  }
+  else {
+    return false;
+  }
+
+  if (place->has_cpus)
+    CPU_AND(&set, &set, &place->cpus);
+
+  // A job can not be given CPUs that quash itself is not allowed to use
+  cpu_set_t allowed;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    CPU_AND(&set, &set, &allowed);
+
+  if (CPU_COUNT(&set) == 0)
+    return false;
+
+  place->cpus = set;
+  place->has_cpus = true;
+  place->node = node;
+
+  return true;
+}
+
+// Get the placement for the next job spread over the machine
+Placement next_spread_placement() {
+  static cpu_set_t nodes; // Node lists share the format of CPU lists
+  static int num_nodes = -1;
+  static unsigned int next = 0;
+
+  Placement place = new_placement();
+
+  if (num_nodes < 0)
+    num_nodes = __read_list("/sys/devices/system/node/online", &nodes) ?
+      CPU_COUNT(&nodes) : 0;
+
+  for (int tries = 0; num_nodes > 1 && tries < num_nodes; ++tries) {
+    char spec[32];
+
+    snprintf(spec, sizeof(spec), "node=%d",
+             __nth_member(&nodes, next++ % num_nodes));
+
+    if (parse_placement(&place, spec))
+      return place;
+
+    place = new_placement();
+  }
+
+  // With a single node the jobs are spread over the CPUs instead
+  cpu_set_t allowed;
+
+  if (num_nodes > 1 || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return place;
+
+  CPU_SET(__nth_member(&allowed, next++ % CPU_COUNT(&allowed)), &place.cpus);
+  place.has_cpus = true;
+
+  return place;
+}
+
+// Apply a placement to the calling thread
+void apply_placement(const Placement* place, Placement* saved) {
+  if (saved != NULL) {
+    *saved = new_placement();
+
+    saved->has_cpus = place->has_cpus &&
+      sched_getaffinity(0, sizeof(saved->cpus), &saved->cpus) == 0;
+
+    // Marks that the memory policy has to be reset
+    saved->node = place->node;
+  }
+
+  if (place->has_cpus &&
+      sched_setaffinity(0, sizeof(place->cpus), &place->cpus) != 0)
+    perror("ERROR: Failed to set CPU affinity");
+
+  if (place->node >= 0) {
+    unsigned long mask[MAX_NODES / NODE_WORD_BITS] = { 0 };
+
+    mask[place->node / NODE_WORD_BITS] |= 1UL << (place->node % NODE_WORD_BITS);
+
+    // Preferring the node rather than binding to it lets allocations fall
+    // back to other nodes instead of failing when the node is full
+    if (__set_mempolicy(MPOL_PREFERRED, mask, MAX_NODES + 1) != 0)
+      perror("ERROR: Failed to set memory policy");
+  }
+}
+
+// Undo apply_placement()
+void restore_placement(const Placement* saved) {
+  if (saved->has_cpus)
+    sched_setaffinity(0, sizeof(saved->cpus), &saved->cpus);
+
+  // quash never sets a memory policy for itself, so the previous one is always
+  // the default
+  if (saved->node >= 0)
+    __set_mempolicy(MPOL_DEFAULT, NULL, 0);
+}
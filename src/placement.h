@@ -0,0 +1,79 @@
+/**
+ * @file placement.h
+ *
+ * @brief CPU affinity and NUMA memory placement of jobs.
+ *
+ * A placement is applied to the thread that creates the processes of a job.
+ * Both the CPU mask and the memory policy of a thread are inherited through
+ * fork(), posix_spawn() and exec(), so every stage starts on the requested
+ * CPUs without a helper such as taskset or numactl.
+ *
+ * @note cpu_set_t needs _GNU_SOURCE to be defined before any system header is
+ * included.
+ */
+
+#ifndef SRC_PLACEMENT_H
+#define SRC_PLACEMENT_H
+
+#include <sched.h>
+#include <stdbool.h>
+
+/**
+ * @brief Where the processes of a job run and allocate memory
+ */
+typedef struct Placement {
+  cpu_set_t cpus; /**< CPUs the processes may run on */
+  bool has_cpus;  /**< @a cpus was given. Otherwise the mask is inherited. */
+  int node;       /**< NUMA node memory is preferably allocated on or -1 */
+} Placement;
+
+/**
+ * @brief Create a placement that changes nothing
+ *
+ * @return A placement with no CPUs and no node
+ */
+Placement new_placement();
+
+/**
+ * @brief Add one `cpus=LIST` or `node=N` specification to a placement
+ *
+ * A CPU list is a comma separated list of CPU numbers and ranges such as
+ * 0-7,16. A node restricts the CPUs to those of the node and prefers its
+ * memory. When both are given the CPUs are limited to the intersection.
+ *
+ * @param place Placement to update
+ *
+ * @param spec The specification
+ *
+ * @return False if the specification is invalid or leaves no usable CPU
+ */
+bool parse_placement(Placement* place, const char* spec);
+
+/**
+ * @brief The placement for the next job spread over the machine
+ *
+ * On a machine with more than one NUMA node successive calls rotate through
+ * the nodes. Otherwise they rotate through the CPUs quash may run on.
+ *
+ * @return The placement
+ */
+Placement next_spread_placement();
+
+/**
+ * @brief Apply a placement to the calling thread
+ *
+ * @param place Placement to apply
+ *
+ * @param saved If not NULL the previous placement of the thread is stored here
+ * for restore_placement()
+ */
+void apply_placement(const Placement* place, Placement* saved);
+
+/**
+ * @brief Undo apply_placement()
+ *
+ * @param saved Placement stored by apply_placement()
+ */
+void restore_placement(const Placement* saved);
+
+#endif
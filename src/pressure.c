@@ -0,0 +1,138 @@
+/**
+ * @file pressure.c
+ *
+ * @brief Implements reading pressure stall information and comparing it to
+ * the thresholds
+ */
+
+#include "pressure.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+/**
+ * @brief A resource whose pressure can be limited
+ */
+typedef struct PressureInfo {
+  const char* name; /**< File in the pressure directory the kernel reports
+                     * the pressure in */
+  double threshold; /**< Percentage of time stalled that counts as high or 0
+                     * if the resource is not watched */
+  int fd;           /**< The file opened once and re-read with pread() or -1 */
+} PressureInfo;
+
+// Same order as PressureResource
+static PressureInfo resources[NUM_PRESSURE_RESOURCES] = {
+  { "cpu", 0, -1 },
+  { "memory", 0, -1 },
+  { "io", 0, -1 },
+};
+
+// Read the ten second average of the some line. Returns -1 on failure.
+static double __read_avg10(PressureInfo* info) {
+  char buf[256];
+  ssize_t n;
+
+  if (info->fd < 0) {
+    // The directory can be pointed elsewhere with the QUASH_PRESSURE_DIR
+    // environment variable
+    const char* dir = lookup_env("QUASH_PRESSURE_DIR");
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", (dir != NULL) ? dir : "/proc/pressure",
+             info->name);
+    info->fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  if (info->fd < 0 || (n = pread(info->fd, buf, sizeof(buf) - 1, 0)) <= 0)
+    return -1;
+
+  buf[n] = '\0';
+
+  // "some avg10=1.35 avg60=2.89 avg300=2.36 total=115157271"
+  const char* avg10 = strstr(buf, "some avg10=");
+
+  return (avg10 != NULL) ? strtod(avg10 + 11, NULL) : -1;
+}
+
+// Check if any threshold is set
+bool pressure_throttling() {
+  for (int i = 0; i < NUM_PRESSURE_RESOURCES; ++i)
+    if (resources[i].threshold > 0)
+      return true;
+
+  return false;
+}
+
+// Set the threshold of a resource
+bool set_pressure_threshold(PressureResource res, const char* value) {
+  PressureInfo* info = &resources[res];
+
+  if (strcmp(value, "off") == 0) {
+    info->threshold = 0;
+    return true;
+  }
+
+  char* end;
+  double threshold = strtod(value, &end);
+
+  if (end == value || *end != '\0' || !(threshold > 0 && threshold <= 100))
+    return false;
+
+  // Refuse a threshold that could never be checked
+  if (__read_avg10(info) < 0)
+    return false;
+
+  info->threshold = threshold;
+
+  return true;
+}
+
+// Print the threshold of a resource
+void print_pressure_threshold(FILE* out, PressureResource res) {
+  static const char* names[NUM_PRESSURE_RESOURCES] = {
+    "cpupressure", "mempressure", "iopressure"
+  };
+
+  if (resources[res].threshold > 0)
+    fprintf(out, "%s\t%g\n", names[res], resources[res].threshold);
+  else
+    fprintf(out, "%s\toff\n", names[res]);
+}
+
+// Compare the pressure to the thresholds
+PressureLevel check_pressure() {
+  PressureLevel level = PRESSURE_LOW;
+
+  for (int i = 0; i < NUM_PRESSURE_RESOURCES; ++i) {
+    PressureInfo* info = &resources[i];
+
+    if (info->threshold <= 0)
+      continue;
+
+    double avg10 = __read_avg10(info);
+
+    if (avg10 > info->threshold)
+      return PRESSURE_HIGH;
+
+    if (avg10 < 0 || avg10 >= info->threshold / 2)
+      level = PRESSURE_MEDIUM;
+  }
+
+  return level;
+}
+
+// Close the pressure files
+void destroy_pressure() {
+  for (int i = 0; i < NUM_PRESSURE_RESOURCES; ++i) {
+    if (resources[i].fd >= 0)
+      close(resources[i].fd);
+
+    resources[i].fd = -1;
+  }
+}
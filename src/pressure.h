@@ -0,0 +1,85 @@
+/**
+ * @file pressure.h
+ *
+ * @brief Pressure stall information thresholds for throttling background jobs.
+ *
+ * The kernel reports in /proc/pressure how much of the time some task was
+ * stalled waiting on CPU, memory or I/O. Each resource can be given a
+ * threshold on the ten second average of that share. Above a threshold the
+ * pressure is high. Below half of every threshold it is low, and in between it
+ * is left as it is so jobs are not stopped and continued back and forth.
+ *
+ * The QUASH_PRESSURE_DIR environment variable replaces /proc/pressure as the
+ * directory the files are read from. It is looked up when a file is first
+ * opened.
+ */
+
+#ifndef SRC_PRESSURE_H
+#define SRC_PRESSURE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Resources the kernel reports pressure for
+ */
+typedef enum PressureResource {
+  PRESSURE_CPU,       /**< /proc/pressure/cpu */
+  PRESSURE_MEMORY,    /**< /proc/pressure/memory */
+  PRESSURE_IO,        /**< /proc/pressure/io */
+  NUM_PRESSURE_RESOURCES,
+} PressureResource;
+
+/**
+ * @brief Pressure measured against the thresholds
+ */
+typedef enum PressureLevel {
+  PRESSURE_LOW,    /**< Every resource is below half of its threshold */
+  PRESSURE_MEDIUM, /**< Neither high nor low */
+  PRESSURE_HIGH,   /**< Some resource is above its threshold */
+} PressureLevel;
+
+/**
+ * @brief Check if any threshold is set
+ *
+ * @return False if pressure should be ignored
+ */
+bool pressure_throttling();
+
+/**
+ * @brief Set the threshold of a resource
+ *
+ * @param res The resource
+ *
+ * @param value `off` or the percentage of time stalled, above 0 and at most
+ * 100
+ *
+ * @return False if @a value is invalid or the kernel does not report pressure
+ * for @a res
+ */
+bool set_pressure_threshold(PressureResource res, const char* value);
+
+/**
+ * @brief Print the threshold of a resource
+ *
+ * @param out Stream to print to
+ *
+ * @param res The resource
+ */
+void print_pressure_threshold(FILE* out, PressureResource res);
+
+/**
+ * @brief Read the pressure files and compare them to the thresholds
+ *
+ * Resources without a threshold are not read.
+ *
+ * @return The level of the pressure. Always low without thresholds.
+ */
+PressureLevel check_pressure();
+
+/**
+ * @brief Close the pressure files
+ */
+void destroy_pressure();
+
+#endif
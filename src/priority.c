@@ -0,0 +1,155 @@
+/**
+ * @file priority.c
+ *
+ * @brief Implements CPU and I/O scheduling priority of jobs
+ */
+
+#define _GNU_SOURCE // for SCHED_BATCH
+
+#include "priority.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Values from linux/ioprio.h, which older kernel headers do not install
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+/**
+ * @brief Arguments of a spawn made on a separate thread
+ */
+typedef struct PrioritySpawn {
+  const Priority* prio; /**< Priority of the new process */
+  const char* path;     /**< Location of the executable */
+  char** args;          /**< Arguments of the new process */
+  SpawnIO io;           /**< Standard streams of the new process */
+  pid_t pgid;           /**< Process group of the new process */
+  pid_t pid;            /**< The new process or -1 */
+} PrioritySpawn;
+
+// The C library has no wrapper for ioprio_set()
+static int __ioprio_set(int ioprio) {
+#ifdef SYS_ioprio_set
+  return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Create a priority that changes nothing
+Priority new_priority() {
+  Priority prio = { 0, IO_CLASS_INHERIT, 0, false };
+
+  return prio;
+}
+
+// Check if a priority changes anything
+bool priority_is_set(const Priority* prio) {
+  return prio->nice != 0 || prio->io_class != IO_CLASS_INHERIT || prio->batch;
+}
+
+// Set the I/O class of a priority
+bool parse_io_class(Priority* prio, const char* spec) {
+  if (strcmp(spec, "idle") == 0) {
+    prio->io_class = IO_CLASS_IDLE;
+    prio->io_level = 0;
+    return true;
+  }
+
+  if (strncmp(spec, "best-effort", 11) != 0)
+    return false;
+
+  int level = 4;
+
+  if (spec[11] == ':') {
+    if (spec[12] < '0' || spec[12] > '7' || spec[13] != '\0')
+      return false;
+
+    level = spec[12] - '0';
+  }
+  else if (spec[11] != '\0') {
+    return false;
+  }
+
+  prio->io_class = IO_CLASS_BEST_EFFORT;
+  prio->io_level = level;
+
+  return true;
+}
+
+// Get a named priority for background jobs
+bool parse_priority_preset(Priority* prio, const char* name) {
+  *prio = new_priority();
+
+  if (strcmp(name, "nice") == 0) {
+    prio->nice = 10;
+    parse_io_class(prio, "best-effort:7");
+  }
+  else if (strcmp(name, "idle") == 0) {
+    prio->nice = 19;
+    parse_io_class(prio, "idle");
+  }
+  else if (strcmp(name, "batch") == 0) {
+    prio->batch = true;
+    parse_io_class(prio, "best-effort:7");
+  }
+  else if (strcmp(name, "off") != 0) {
+    return false;
+  }
+
+  return true;
+}
+
+// Apply a priority to the calling thread
+void apply_priority(const Priority* prio) {
+  if (prio->batch) {
+    struct sched_param param = { 0 };
+
+    if (sched_setscheduler(0, SCHED_BATCH, &param) != 0)
+      perror("ERROR: Failed to set scheduling policy");
+  }
+
+  // nice() may legitimately return -1, so errors are told apart by errno
+  errno = 0;
+
+  if (prio->nice != 0 && nice(prio->nice) == -1 && errno != 0)
+    perror("ERROR: Failed to set nice value");
+
+  if (prio->io_class != IO_CLASS_INHERIT &&
+      __ioprio_set((prio->io_class << IOPRIO_CLASS_SHIFT) | prio->io_level) != 0)
+    perror("ERROR: Failed to set I/O priority");
+}
+
+// Spawn a program from a thread that takes on the priority first
+static void* __spawn_thread(void* arg) {
+  PrioritySpawn* ps = arg;
+
+  apply_priority(ps->prio);
+  ps->pid = spawn_generic(ps->path, ps->args, ps->io, ps->pgid);
+
+  return NULL;
+}
+
+// Start a program under a priority
+pid_t spawn_with_priority(const Priority* prio, const char* path, char** args,
+                          SpawnIO io, pid_t pgid) {
+  PrioritySpawn ps = { prio, path, args, io, pgid, -1 };
+  pthread_t thread;
+  int err;
+
+  if ((err = pthread_create(&thread, NULL, __spawn_thread, &ps)) != 0) {
+    fprintf(stderr, "ERROR: Failed to execute program: %s\n", strerror(err));
+    return -1;
+  }
+
+  pthread_join(thread, NULL);
+
+  return ps.pid;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file priority.h
+ *
+ * @brief CPU and I/O scheduling priority of jobs.
+ *
+ * The nice value, I/O priority and scheduling policy are all attributes of a
+ * thread on Linux and are inherited by processes it creates. Lowering them is
+ * not reversible without privileges, so they are applied in the child on the
+ * fork() path and on a short lived thread that calls posix_spawn() otherwise,
+ * never on a thread of quash that lives on.
+ */
+
+#ifndef SRC_PRIORITY_H
+#define SRC_PRIORITY_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "spawner.h"
+
+/**
+ * @brief I/O scheduling classes in the numbering used by the kernel
+ */
+typedef enum IOClass {
+  IO_CLASS_INHERIT = 0,     /**< Keep the I/O priority of quash */
+  IO_CLASS_BEST_EFFORT = 2, /**< Share the disk according to a level */
+  IO_CLASS_IDLE = 3,        /**< Only use the disk when nothing else does */
+} IOClass;
+
+/**
+ * @brief How the processes of a job are scheduled
+ */
+typedef struct Priority {
+  int nice;         /**< Added to the nice value of quash */
+  IOClass io_class; /**< I/O scheduling class */
+  int io_level;     /**< Level within the best effort class from 0 (highest) to
+                     * 7 (lowest) */
+  bool batch;       /**< Run under the SCHED_BATCH policy */
+} Priority;
+
+/**
+ * @brief Create a priority that changes nothing
+ *
+ * @return The priority
+ */
+Priority new_priority();
+
+/**
+ * @brief Check if a priority changes anything
+ *
+ * @param prio The priority
+ *
+ * @return False if @a prio leaves the scheduling of a job as it is
+ */
+bool priority_is_set(const Priority* prio);
+
+/**
+ * @brief Set the I/O class of a priority
+ *
+ * @param prio Priority to update
+ *
+ * @param spec `idle` or `best-effort` with an optional `:LEVEL`
+ *
+ * @return False if @a spec is invalid
+ */
+bool parse_io_class(Priority* prio, const char* spec);
+
+/**
+ * @brief Get a named priority for background jobs
+ *
+ * `nice` adds 10 to the nice value and uses the lowest best effort I/O level,
+ * `idle` adds 19 and uses the idle I/O class, `batch` runs under SCHED_BATCH
+ * with the lowest best effort I/O level and `off` changes nothing.
+ *
+ * @param prio The priority is stored here
+ *
+ * @param name Name of the priority
+ *
+ * @return False if @a name is unknown
+ */
+bool parse_priority_preset(Priority* prio, const char* name);
+
+/**
+ * @brief Apply a priority to the calling thread
+ *
+ * Errors are reported to standard error and otherwise ignored.
+ *
+ * @param prio Priority to apply
+ */
+void apply_priority(const Priority* prio);
+
+/**
+ * @brief Start a program with spawn_generic() under a priority
+ *
+ * @param prio Priority of the new process
+ *
+ * @param path Location of the executable
+ *
+ * @param args A NULL terminated array of strings
+ *
+ * @param io Standard streams of the new process
+ *
+ * @param pgid Process group to place the new process in, as for spawn_generic()
+ *
+ * @return The process id of the new process or -1 if it could not be started
+ *
+ * @sa spawn_generic
+ */
+pid_t spawn_with_priority(const Priority* prio, const char* path, char** args,
+                          SpawnIO io, pid_t pgid);
+
+#endif
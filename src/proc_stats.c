@@ -0,0 +1,323 @@
+/**
+ * @file proc_stats.c
+ *
+ * @brief Implements sampling of process usage from /proc with cached
+ * descriptors kept in an open addressing hash table
+ */
+
+#include "proc_stats.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief The open /proc files of a process and its previous sample
+ */
+typedef struct ProcFiles {
+  pid_t pid;                /**< Process the files belong to. 0 marks an empty
+                             * slot */
+  int stat_fd;              /**< /proc/PID/stat */
+  int statm_fd;             /**< /proc/PID/statm */
+  int io_fd;                /**< /proc/PID/io or -1 if it can not be read */
+  unsigned long long ticks; /**< CPU time in clock ticks at the last sample */
+  double when;              /**< Seconds since boot at the last sample */
+  unsigned int last_round;  /**< Round the process was last sampled in */
+} ProcFiles;
+
+static ProcFiles* table = NULL;
+static size_t table_cap = 0;
+static size_t table_len = 0;
+
+static unsigned int current_round = 0;
+
+// Most processes whose files are kept open. Set at the start of each round.
+static size_t max_cached = 0;
+
+// Scheduler states from busiest to least busy
+static const char state_order[] = "RDSTtZX";
+
+static size_t __hash(pid_t pid) {
+  return (size_t) ((uint32_t) pid * 2654435761u);
+}
+
+// Find the slot of a process or the empty slot it would go in
+static ProcFiles* __slot(pid_t pid) {
+  size_t mask = table_cap - 1;
+  size_t i = __hash(pid) & mask;
+
+  while (table[i].pid != 0 && table[i].pid != pid)
+    i = (i + 1) & mask;
+
+  return &table[i];
+}
+
+static void __close_files(ProcFiles* files) {
+  close(files->stat_fd);
+  close(files->statm_fd);
+
+  if (files->io_fd >= 0)
+    close(files->io_fd);
+}
+
+// Close the files of a process and take it out of the table. The entries
+// after it in its probe sequence move back so they can still be found.
+static void __remove(ProcFiles* files) {
+  size_t mask = table_cap - 1;
+  size_t hole = files - table;
+
+  __close_files(files);
+  table[hole].pid = 0;
+  --table_len;
+
+  for (size_t i = (hole + 1) & mask; table[i].pid != 0; i = (i + 1) & mask) {
+    size_t home = __hash(table[i].pid) & mask;
+
+    // The entry may only move back if its home slot is not between the hole
+    // and where it sits now
+    bool between = (hole < i) ? (home > hole && home <= i) :
+      (home > hole || home <= i);
+
+    if (!between) {
+      table[hole] = table[i];
+      table[i].pid = 0;
+      hole = i;
+    }
+  }
+}
+
+// Rebuild the table with a new capacity keeping only the entries that pass a
+// test. Entries that fail it have their files closed.
+static void __rebuild(size_t cap, bool (*keep)(const ProcFiles*)) {
+  ProcFiles* old = table;
+  size_t old_cap = table_cap;
+
+  table = calloc(cap, sizeof(ProcFiles));
+  table_cap = cap;
+  table_len = 0;
+
+  for (size_t i = 0; i < old_cap; ++i) {
+    if (old[i].pid == 0)
+      continue;
+
+    if (keep != NULL && !keep(&old[i])) {
+      __close_files(&old[i]);
+      continue;
+    }
+
+    *__slot(old[i].pid) = old[i];
+    ++table_len;
+  }
+
+  free(old);
+}
+
+static bool __sampled_this_round(const ProcFiles* files) {
+  return files->last_round == current_round;
+}
+
+static int __open_proc(pid_t pid, const char* name) {
+  char path[64];
+
+  snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Open the files of a process. Returns false if the process is gone.
+static bool __open_files(pid_t pid, ProcFiles* files) {
+  *files = (ProcFiles) { pid, -1, -1, -1, 0, 0, current_round };
+
+  if ((files->stat_fd = __open_proc(pid, "stat")) < 0)
+    return false;
+
+  if ((files->statm_fd = __open_proc(pid, "statm")) < 0) {
+    close(files->stat_fd);
+    return false;
+  }
+
+  // Without I/O accounting in the kernel the file does not exist
+  files->io_fd = __open_proc(pid, "io");
+
+  return true;
+}
+
+// Add the files of a process to the table
+static ProcFiles* __cache_files(const ProcFiles* files) {
+  if (4 * (table_len + 1) > 3 * table_cap)
+    __rebuild((table_cap == 0) ? 64 : 2 * table_cap, NULL);
+
+  ProcFiles* slot = __slot(files->pid);
+
+  *slot = *files;
+  ++table_len;
+
+  return slot;
+}
+
+// Re-read a /proc file from the start into a NUL terminated buffer
+static bool __read_file(int fd, char* buf, size_t size) {
+  ssize_t n = pread(fd, buf, size - 1, 0);
+
+  if (n <= 0)
+    return false;
+
+  buf[n] = '\0';
+
+  return true;
+}
+
+// Read a counter such as "read_bytes: 42" from /proc/PID/io
+static unsigned long long __io_field(const char* buf, const char* name) {
+  const char* field = strstr(buf, name);
+
+  return (field != NULL) ? strtoull(field + strlen(name), NULL, 10) : 0;
+}
+
+static double __seconds_since_boot() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_BOOTTIME, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Create usage that holds nothing
+ProcStats new_proc_stats() {
+  return (ProcStats) { '?', 0, 0, 0, 0 };
+}
+
+// Start a sampling round
+void proc_stats_begin_round() {
+  struct rlimit lim;
+
+  ++current_round;
+
+  // The cache may take up to a quarter of the descriptors quash may open, so
+  // pipes and redirects of the jobs still have plenty left
+  if (getrlimit(RLIMIT_NOFILE, &lim) != 0 || lim.rlim_cur == RLIM_INFINITY)
+    lim.rlim_cur = 1024;
+
+  max_cached = lim.rlim_cur / 4 / 3;
+}
+
+// Sample the usage of a process
+bool proc_stats_sample(pid_t pid, ProcStats* stats) {
+  static long hz = 0;
+  static long page_size = 0;
+
+  if (hz == 0) {
+    hz = sysconf(_SC_CLK_TCK);
+    page_size = sysconf(_SC_PAGESIZE);
+  }
+
+  ProcFiles* files = (table_cap != 0) ? __slot(pid) : NULL;
+  ProcFiles uncached;
+  bool first = files == NULL || files->pid == 0;
+
+  // The process name is in parentheses and may hold spaces or parentheses of
+  // its own, so the fields are counted from the last closing one
+  char buf[1024];
+  char* fields;
+  char state;
+  unsigned long long utime, stime, start;
+
+  while (true) {
+    if (first) {
+      if (!__open_files(pid, &uncached))
+        return false;
+
+      files = (table_len < max_cached) ? __cache_files(&uncached) : &uncached;
+    }
+
+    files->last_round = current_round;
+
+    if (__read_file(files->stat_fd, buf, sizeof(buf)) &&
+        (fields = strrchr(buf, ')')) != NULL &&
+        sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu "
+               "%llu %*d %*d %*d %*d %*d %*d %llu", &state, &utime, &stime,
+               &start) == 4)
+      break;
+
+    // The files of a process that is gone can not be read any more. Its pid
+    // may have been reused, so the new process is opened from scratch.
+    bool retry = !first;
+
+    if (files == &uncached)
+      __close_files(files);
+    else
+      __remove(files);
+
+    if (!retry)
+      return false;
+
+    first = true;
+  }
+
+  unsigned long long ticks = utime + stime;
+  double now = __seconds_since_boot();
+  double since = first ? (double) start / hz : files->when;
+  unsigned long long used = (first || ticks < files->ticks) ?
+    ticks : ticks - files->ticks;
+
+  *stats = new_proc_stats();
+  stats->state = state;
+  stats->cpu = (now > since) ? 100.0 * used / hz / (now - since) : 0;
+
+  files->ticks = ticks;
+  files->when = now;
+
+  unsigned long long resident;
+
+  if (__read_file(files->statm_fd, buf, sizeof(buf)) &&
+      sscanf(buf, "%*u %llu", &resident) == 1)
+    stats->rss = resident * page_size;
+
+  if (files->io_fd >= 0 && __read_file(files->io_fd, buf, sizeof(buf))) {
+    stats->read_bytes = __io_field(buf, "read_bytes:");
+    stats->write_bytes = __io_field(buf, "\nwrite_bytes:");
+  }
+
+  // Beyond the size of the cache the files are only open for this sample
+  if (files == &uncached)
+    __close_files(files);
+
+  return true;
+}
+
+// Add the usage of a process to a total
+void proc_stats_add(ProcStats* total, const ProcStats* stats) {
+  const char* a = strchr(state_order, total->state);
+  const char* b = strchr(state_order, stats->state);
+
+  if (a == NULL || (b != NULL && b < a))
+    total->state = stats->state;
+
+  total->cpu += stats->cpu;
+  total->rss += stats->rss;
+  total->read_bytes += stats->read_bytes;
+  total->write_bytes += stats->write_bytes;
+}
+
+// Close the files of processes that were not sampled this round
+void proc_stats_end_round() {
+  if (table_cap != 0)
+    __rebuild(table_cap, __sampled_this_round);
+}
+
+// Close every cached file
+void destroy_proc_stats() {
+  for (size_t i = 0; i < table_cap; ++i)
+    if (table[i].pid != 0)
+      __close_files(&table[i]);
+
+  free(table);
+  table = NULL;
+  table_cap = 0;
+  table_len = 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file proc_stats.h
+ *
+ * @brief Resource usage of job processes sampled from /proc.
+ *
+ * The stat, statm and io files of each process are opened once and re-read
+ * with pread() on every sample, so a sample costs three reads per process
+ * rather than three opens, reads and closes. Descriptors are dropped at the
+ * end of a sampling round for every process that was not sampled in it, and
+ * as soon as a read fails. The cache holds at most a quarter of the
+ * RLIMIT_NOFILE soft limit; processes beyond that are read without caching.
+ * Callers that sample only once should call destroy_proc_stats() afterwards.
+ */
+
+#ifndef SRC_PROC_STATS_H
+#define SRC_PROC_STATS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @brief Usage of one process or the sum over the processes of a job
+ */
+typedef struct ProcStats {
+  char state;                    /**< Scheduler state letter as shown by ps */
+  double cpu;                    /**< CPU use in percent of one CPU */
+  unsigned long long rss;        /**< Resident memory in bytes */
+  unsigned long long read_bytes; /**< Bytes read from storage */
+  unsigned long long write_bytes; /**< Bytes written to storage */
+} ProcStats;
+
+/**
+ * @brief Create usage that holds nothing, ready to be summed into
+ *
+ * @return Zeroed usage with an unknown state
+ */
+ProcStats new_proc_stats();
+
+/**
+ * @brief Start a sampling round
+ *
+ * @sa proc_stats_end_round
+ */
+void proc_stats_begin_round();
+
+/**
+ * @brief Sample the usage of a process
+ *
+ * CPU use is averaged since the previous sample of the process, or over its
+ * lifetime if this is the first one.
+ *
+ * @param pid Process to sample
+ *
+ * @param stats The usage is stored here
+ *
+ * @return False if the process is gone
+ */
+bool proc_stats_sample(pid_t pid, ProcStats* stats);
+
+/**
+ * @brief Add the usage of a process to a total
+ *
+ * The state of the total becomes the busiest of the two, in the order running,
+ * disk sleep, sleeping, stopped and zombie.
+ *
+ * @param total Usage to add to
+ *
+ * @param stats Usage to add
+ */
+void proc_stats_add(ProcStats* total, const ProcStats* stats);
+
+/**
+ * @brief End a sampling round and close the files of every process that was
+ * not sampled since proc_stats_begin_round()
+ */
+void proc_stats_end_round();
+
+/**
+ * @brief Close every cached file and free all memory held for sampling
+ */
+void destroy_proc_stats();
+
+#endif
@@ -7,24 +7,36 @@
 /**************************************************************************
  * Included Files
  **************************************************************************/
+#define _GNU_SOURCE // for fopencookie
+
 #include "quash.h"
 
 #include <limits.h>
 #include <stdbool.h>
 #include <string.h>
+#include <termios.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <signal.h>
 
 #include "command.h"
 #include "execute.h"
 #include "parsing_interface.h"
 #include "memory_pool.h"
+#include "job_table.h"
+#include "jobserver.h"
+#include "path_cache.h"
+#include "pressure.h"
+#include "proc_stats.h"
 
 /**************************************************************************
  * Private Variables
  **************************************************************************/
 static QuashState state;
 
+// Terminal modes quash was started with
+static struct termios shell_modes;
+
 /**************************************************************************
  * Private Functions
  **************************************************************************/
@@ -32,7 +44,8 @@ static QuashState initial_state() {
   return (QuashState) {
     true,
     isatty(STDIN_FILENO),
-    NULL
+    NULL,
+    { 0 }
   };
 }
 
@@ -73,6 +86,15 @@ static void print_prompt() {
   fflush(stdout);
 }
 
+// Read a script from standard in. Finished background jobs are reaped while
+// waiting so they do not linger as zombies until the next line arrives.
+static ssize_t read_script(void* cookie, char* buf, size_t size) {
+  while (!wait_for_input(STDIN_FILENO))
+    ;
+
+  return read(STDIN_FILENO, buf, size);
+}
+
 /**************************************************************************
  * Public Functions
  **************************************************************************/
@@ -81,9 +103,18 @@ bool is_running() {
   return state.running;
 }
 
-// Get a copy of the string
+// Build the command string of the current script
 char* get_command_string() {
-  return strdup(state.parsed_str);
+  // Prefix keywords are only stripped from the first stage
+  CommandHolder current = state.script[0];
+
+  state.script[0] = state.first;
+
+  char* str = stringify_script(state.script);
+
+  state.script[0] = current;
+
+  return str;
 }
 
 // Check if Quash is receiving input from the command line or not
@@ -96,6 +127,12 @@ void end_main_loop() {
   state.running = false;
 }
 
+// Put the terminal back into the modes quash was started with
+void restore_terminal_modes() {
+  if (is_tty())
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_modes);
+}
+
 /**
  * @brief Quash entry point
  *
@@ -117,19 +154,55 @@ int main(int argc, char** argv) {
 
   atexit(destroy_parser);
   atexit(destroy_memory_pool);
+  atexit(destroy_path_cache);
+  atexit(destroy_job_table);
+  atexit(destroy_proc_stats);
+  atexit(destroy_pressure);
+  atexit(destroy_jobserver);
+
+  // The memory pool is reused by every line rather than rebuilt each time
+  initialize_memory_pool(1024);
+
+  if (is_tty()) {
+    // Nothing may sit in the buffer of stdin where waiting for the terminal
+    // would not see it
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    tcgetattr(STDIN_FILENO, &shell_modes);
+
+    // Ctrl-Z is meant for the foreground job, and quash takes the terminal
+    // back from a job while it may still be a background group
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+  }
+  else {
+    // Scripts are read a line at a time through wait_for_input() as well, so
+    // a script that arrives slowly is run as it arrives
+    cookie_io_functions_t io = { read_script, NULL, NULL, NULL };
+    FILE* in = fopencookie(NULL, "r", io);
+
+    if (in != NULL)
+      set_parser_input(in);
+  }
 
   // Main execution loop
   while (is_running()) {
-    if (is_tty())
+    if (is_tty()) {
       print_prompt();
 
-    initialize_memory_pool(1024);
+      // Jobs that finish while the user is typing are reported right away,
+      // followed by a fresh prompt
+      while (!wait_for_input(STDIN_FILENO))
+        print_prompt();
+    }
+
     CommandHolder* script = parse(&state);
 
     if (script != NULL)
       run_script(script);
 
-    destroy_memory_pool();
+    reset_memory_pool();
   }
 
   return EXIT_SUCCESS;
@@ -20,8 +20,9 @@ typedef struct QuashState {
   bool running;     /**< Indicates if Quash should keep accept more input */
   bool is_a_tty;    /**< Indicates if the shell is receiving input from a file
                      * or the command line */
-  char* parsed_str; /**< Holds a string representing the parsed structure of the
-                     * command input from the command line */
+  CommandHolder* script; /**< The script last read from the command line */
+  CommandHolder first;   /**< The first stage of the script as it was parsed,
+                          * before any prefix keywords were stripped from it */
 } QuashState;
 
 /**
@@ -32,11 +33,14 @@ typedef struct QuashState {
 bool is_tty();
 
 /**
- * @brief Get a deep copy of the current command string
+ * @brief Build the command string of the current script
+ *
+ * The string is built from the script as it was parsed. Only jobs that are
+ * listed need it, so it is not built for every line.
  *
  * @note The free function must be called on the result eventually
  *
- * @return A copy of the command string
+ * @return The command string
  */
 char* get_command_string();
 
@@ -52,4 +56,12 @@ bool is_running();
  */
 void end_main_loop();
 
+/**
+ * @brief Put the terminal back into the modes Quash was started with
+ *
+ * Programs such as editors change the modes of the terminal and can not undo
+ * that when they are stopped. Does nothing unless Quash reads from a TTY.
+ */
+void restore_terminal_modes();
+
 #endif // QUASH_H
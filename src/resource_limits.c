@@ -0,0 +1,310 @@
+/**
+ * @file resource_limits.c
+ *
+ * @brief Implements resource limits of jobs and the ulimit builtin
+ */
+
+#include "resource_limits.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief A resource the ulimit builtin knows about
+ */
+typedef struct LimitInfo {
+  char option;         /**< Option letter of ulimit */
+  int resource;        /**< Resource passed to setrlimit() */
+  rlim_t unit;         /**< Bytes or seconds per unit of the values shown */
+  const char* name;    /**< Description for ulimit -a */
+} LimitInfo;
+
+// Same order as ResourceLimits::values
+static const LimitInfo limit_info[NUM_RESOURCE_LIMITS] = {
+  { 't', RLIMIT_CPU, 1, "cpu time (seconds)" },
+  { 'v', RLIMIT_AS, 1024, "virtual memory (kbytes)" },
+  { 'n', RLIMIT_NOFILE, 1, "open files" },
+  { 'u', RLIMIT_NPROC, 1, "max user processes" },
+};
+
+// Limits set with the ulimit builtin
+static ResourceLimits session_limits = { .soft = 0, .hard = 0 };
+
+// Find a resource by its option letter. Returns -1 if there is none.
+static int __find_limit(char option) {
+  for (int i = 0; i < NUM_RESOURCE_LIMITS; ++i)
+    if (limit_info[i].option == option)
+      return i;
+
+  return -1;
+}
+
+// Parse a limit value in units of a resource
+static bool __parse_value(const char* str, int i, rlim_t* value) {
+  if (strcmp(str, "unlimited") == 0) {
+    *value = RLIM_INFINITY;
+    return true;
+  }
+
+  char* end;
+
+  errno = 0;
+  unsigned long long n = strtoull(str, &end, 10);
+
+  if (str[0] < '0' || str[0] > '9' || *end != '\0' || errno != 0 ||
+      n > RLIM_INFINITY / limit_info[i].unit)
+    return false;
+
+  *value = n * limit_info[i].unit;
+
+  return true;
+}
+
+// Parse an option such as -v or -H. Returns false if it is not one.
+static bool __parse_option(const char* arg, bool* soft, bool* hard, int* i) {
+  if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0')
+    return false;
+
+  *i = -1;
+
+  if (arg[1] == 'H' || arg[1] == 'S') {
+    *soft = arg[1] == 'S';
+    *hard = arg[1] == 'H';
+    return true;
+  }
+
+  return (*i = __find_limit(arg[1])) >= 0;
+}
+
+// Print a limit value in units of a resource
+static void __print_value(FILE* out, rlim_t value, int i) {
+  if (value == RLIM_INFINITY)
+    fprintf(out, "unlimited\n");
+  else
+    fprintf(out, "%llu\n", (unsigned long long) (value / limit_info[i].unit));
+}
+
+// Get the limit a job starts out with for a resource
+static struct rlimit __session_limit(int i) {
+  struct rlimit lim;
+  unsigned int bit = 1u << i;
+
+  getrlimit(limit_info[i].resource, &lim);
+
+  if (session_limits.soft & bit)
+    lim.rlim_cur = session_limits.values[i].rlim_cur;
+
+  if (session_limits.hard & bit)
+    lim.rlim_max = session_limits.values[i].rlim_max;
+
+  return lim;
+}
+
+// Print the limit a job would get for a resource
+static void __print_limit(FILE* out, int i, bool hard, bool with_name) {
+  struct rlimit lim = __session_limit(i);
+
+  if (with_name)
+    fprintf(out, "-%c: %-26s", limit_info[i].option, limit_info[i].name);
+
+  __print_value(out, hard ? lim.rlim_max : lim.rlim_cur, i);
+}
+
+// Set one resource in the calling process. Returns false on failure.
+static bool __apply(const ResourceLimits* limits, int i) {
+  unsigned int bit = 1u << i;
+
+  if (!((limits->soft | limits->hard) & bit))
+    return true;
+
+  struct rlimit lim;
+
+  getrlimit(limit_info[i].resource, &lim);
+
+  if (limits->hard & bit)
+    lim.rlim_max = limits->values[i].rlim_max;
+
+  if (limits->soft & bit)
+    lim.rlim_cur = limits->values[i].rlim_cur;
+
+  // Lowering only the hard limit drags the soft limit along
+  if (lim.rlim_max != RLIM_INFINITY &&
+      (lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur > lim.rlim_max))
+    lim.rlim_cur = lim.rlim_max;
+
+  if (setrlimit(limit_info[i].resource, &lim) != 0) {
+    fprintf(stderr, "ulimit: -%c: %s\n", limit_info[i].option, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+// Create an empty set of limits
+ResourceLimits new_resource_limits() {
+  ResourceLimits limits;
+
+  memset(&limits, 0, sizeof(limits));
+
+  return limits;
+}
+
+// Parse ulimit options that set limits
+size_t parse_resource_limits(ResourceLimits* limits, char** args, bool report) {
+  ResourceLimits parsed = *limits;
+  bool soft = true;
+  bool hard = true;
+  bool any = false;
+  size_t n = 1;
+  int i;
+
+  for (; args[n] != NULL && args[n][0] == '-'; ++n) {
+    if (!__parse_option(args[n], &soft, &hard, &i)) {
+      if (report)
+        fprintf(stderr, "ulimit: %s: invalid option\n", args[n]);
+
+      return 0;
+    }
+
+    if (i < 0)
+      continue;
+
+    rlim_t value;
+
+    if (args[n + 1] == NULL || !__parse_value(args[n + 1], i, &value)) {
+      if (report)
+        fprintf(stderr, "ulimit: %s: invalid limit\n",
+                (args[n + 1] != NULL) ? args[n + 1] : args[n]);
+
+      return 0;
+    }
+
+    ++n;
+    any = true;
+
+    if (soft) {
+      parsed.values[i].rlim_cur = value;
+      parsed.soft |= 1u << i;
+    }
+
+    if (hard) {
+      parsed.values[i].rlim_max = value;
+      parsed.hard |= 1u << i;
+    }
+
+    // A process that reaches a hard CPU limit gets SIGKILL, which looks like
+    // any other kill. Leave a second of headroom so SIGXCPU from the soft
+    // limit arrives first.
+    if (soft && hard && limit_info[i].resource == RLIMIT_CPU &&
+        value < __session_limit(i).rlim_max)
+      parsed.values[i].rlim_max = value + 1;
+  }
+
+  if (!any)
+    return 0;
+
+  // Catch what setrlimit() would refuse before a job is started with it. Once
+  // the session lowered a hard limit no job can raise it again.
+  for (i = 0; i < NUM_RESOURCE_LIMITS; ++i) {
+    unsigned int bit = 1u << i;
+    struct rlimit cur = __session_limit(i);
+    rlim_t max = (parsed.hard & bit) ? parsed.values[i].rlim_max : cur.rlim_max;
+
+    if ((parsed.hard & bit) && max > cur.rlim_max && geteuid() != 0) {
+      if (report)
+        fprintf(stderr, "ulimit: -%c: cannot raise the hard limit\n",
+                limit_info[i].option);
+
+      return 0;
+    }
+
+    if ((parsed.soft & bit) && parsed.values[i].rlim_cur > max) {
+      if (report)
+        fprintf(stderr, "ulimit: -%c: soft limit exceeds the hard limit\n",
+                limit_info[i].option);
+
+      return 0;
+    }
+  }
+
+  *limits = parsed;
+
+  return n;
+}
+
+// Check if a job needs any limits applied
+bool have_resource_limits(const ResourceLimits* job) {
+  return (session_limits.soft | session_limits.hard | job->soft | job->hard) != 0;
+}
+
+// Apply the session limits and then the limits of a job
+bool apply_resource_limits(const ResourceLimits* job) {
+  for (int i = 0; i < NUM_RESOURCE_LIMITS; ++i)
+    if (!__apply(&session_limits, i) || !__apply(job, i))
+      return false;
+
+  return true;
+}
+
+// Check if a signal is sent for exceeding a resource limit
+bool is_limit_signal(int sig) {
+  return sig == SIGXCPU || sig == SIGXFSZ;
+}
+
+// Sets or prints the session limits
+void run_ulimit(char** args, FILE* out) {
+  ResourceLimits limits = session_limits;
+  size_t n = parse_resource_limits(&limits, args, false);
+
+  if (n != 0 && args[n] != NULL) {
+    fprintf(stderr, "ulimit: %s: unexpected argument\n", args[n]);
+    return;
+  }
+
+  if (n != 0) {
+    session_limits = limits;
+    return;
+  }
+
+  // A value that did not parse. Parse again to report why.
+  for (size_t k = 1; args[k] != NULL; ++k) {
+    if (args[k][0] != '-') {
+      parse_resource_limits(&limits, args, true);
+      return;
+    }
+  }
+
+  bool soft = true;
+  bool hard = true;
+  bool printed = false;
+  int i;
+
+  for (size_t k = 1; args[k] != NULL; ++k) {
+    if (strcmp(args[k], "-a") == 0) {
+      for (int j = 0; j < NUM_RESOURCE_LIMITS; ++j)
+        __print_limit(out, j, !soft, true);
+
+      printed = true;
+    }
+    else if (!__parse_option(args[k], &soft, &hard, &i)) {
+      fprintf(stderr, "ulimit: usage: ulimit [-H|-S] [-a | -t|-v|-n|-u "
+              "[VALUE] ...]\n");
+      return;
+    }
+    else if (i >= 0) {
+      __print_limit(out, i, !soft, false);
+      printed = true;
+    }
+  }
+
+  // Without a resource every limit is shown
+  if (!printed)
+    for (int j = 0; j < NUM_RESOURCE_LIMITS; ++j)
+      __print_limit(out, j, !soft, true);
+
+  fflush(out);
+}
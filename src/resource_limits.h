@@ -0,0 +1,112 @@
+/**
+ * @file resource_limits.h
+ *
+ * @brief Resource limits of jobs and the ulimit builtin.
+ *
+ * Limits set with the ulimit builtin apply to every job started afterwards
+ * but not to quash itself, so a tight memory limit can not leave the shell
+ * unable to run anything. `ulimit -v N command ...` limits a single job on
+ * top of them. Limits are set with setrlimit() in the child between fork()
+ * and exec(), so every stage of a pipeline gets them.
+ */
+
+#ifndef SRC_RESOURCE_LIMITS_H
+#define SRC_RESOURCE_LIMITS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+/**
+ * @brief Number of resources that can be limited
+ */
+#define NUM_RESOURCE_LIMITS 4
+
+/**
+ * @brief Limits given for a job or the session
+ */
+typedef struct ResourceLimits {
+  struct rlimit values[NUM_RESOURCE_LIMITS]; /**< Limits in the order cpu time,
+                                              * virtual memory, open files and
+                                              * processes */
+  unsigned int soft; /**< Bit i is set if the soft limit of resource i was
+                      * given */
+  unsigned int hard; /**< Bit i is set if the hard limit of resource i was
+                      * given */
+} ResourceLimits;
+
+/**
+ * @brief Create an empty set of limits
+ *
+ * @return Limits that change nothing
+ */
+ResourceLimits new_resource_limits();
+
+/**
+ * @brief Parse ulimit options that set limits
+ *
+ * `[-H|-S] -t|-v|-n|-u VALUE ...` where VALUE is a number or unlimited. -H
+ * and -S select the hard or soft limit for the options after them. Without
+ * either both are set, except that the hard CPU time limit is one second above
+ * the soft one so the process is sent SIGXCPU rather than SIGKILL. Limits that setrlimit() would refuse are rejected.
+ *
+ * @param limits The limits are added here
+ *
+ * @param args A NULL terminated array of strings starting with "ulimit"
+ *
+ * @param report Print the reason to standard error if the options are
+ * invalid
+ *
+ * @return The index of the first argument after the options or 0 if the
+ * options are invalid or do not set a limit
+ */
+size_t parse_resource_limits(ResourceLimits* limits, char** args, bool report);
+
+/**
+ * @brief Check if a job needs any limits applied
+ *
+ * @param job Limits given for the job
+ *
+ * @return True if either @a job or the session sets a limit
+ */
+bool have_resource_limits(const ResourceLimits* job);
+
+/**
+ * @brief Apply the session limits followed by the limits of a job to the
+ * calling process
+ *
+ * Errors are reported to standard error.
+ *
+ * @param job Limits given for the job
+ *
+ * @return False if a limit could not be set
+ */
+bool apply_resource_limits(const ResourceLimits* job);
+
+/**
+ * @brief Check if a process was killed for exceeding a resource limit
+ *
+ * @param sig Signal that terminated the process
+ *
+ * @return True if the kernel sends @a sig when a limit is exceeded
+ */
+bool is_limit_signal(int sig);
+
+/**
+ * @brief Run the builtin ulimit command
+ *
+ * `ulimit [-H|-S] [-a | -t|-v|-n|-u [VALUE] ...]`
+ *
+ * Sets the session limits or prints them when no value is given. -t is CPU
+ * time in seconds, -v virtual memory in kilobytes, -n open files and -u
+ * processes of the user. Limits that were never set are shown as inherited
+ * from quash.
+ *
+ * @param args A NULL terminated array of strings starting with "ulimit"
+ *
+ * @param out Stream to print the limits to
+ */
+void run_ulimit(char** args, FILE* out);
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * @file spawner.c
+ *
+ * @brief Implements the posix_spawn() based process creation path
+ */
+
+#include "spawner.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+extern char** environ;
+
+// Check if the fast spawn path is selected
+bool use_fast_spawn() {
+  const char* mode = lookup_env("QUASH_SPAWN");
+
+  return mode == NULL || strcmp(mode, "fork") != 0;
+}
+
+// Translate the streams of a process into spawn file actions
+static int __add_io_actions(posix_spawn_file_actions_t* actions, SpawnIO io) {
+  int err = 0;
+
+  if (io.redirect_in != NULL)
+    err = posix_spawn_file_actions_addopen(actions, STDIN_FILENO,
+                                           io.redirect_in, O_RDONLY, 0);
+
+  if (!err && io.redirect_out != NULL) {
+    int flags = O_WRONLY | O_CREAT | (io.append ? O_APPEND : O_TRUNC);
+
+    err = posix_spawn_file_actions_addopen(actions, STDOUT_FILENO,
+                                           io.redirect_out, flags, 0666);
+  }
+
+  // Pipes are created close-on-exec so only the duplicated ends survive into
+  // the new program
+  if (!err && io.in_fd >= 0)
+    err = posix_spawn_file_actions_adddup2(actions, io.in_fd, STDIN_FILENO);
+
+  if (!err && io.out_fd >= 0)
+    err = posix_spawn_file_actions_adddup2(actions, io.out_fd, STDOUT_FILENO);
+
+  return err;
+}
+
+// Start a generic command without copying the quash address space
+pid_t spawn_generic(const char* path, char** args, SpawnIO io, pid_t pgid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  pid_t pid;
+  int err;
+
+  if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+    fprintf(stderr, "ERROR: Failed to execute program: %s\n", strerror(err));
+    return -1;
+  }
+
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    fprintf(stderr, "ERROR: Failed to execute program: %s\n", strerror(err));
+    return -1;
+  }
+
+  // The child joins the group of the job before it runs so a signal sent to
+  // the job can never miss it. The keyboard stop signals quash ignores on a
+  // terminal are handed back to the program.
+  sigset_t job_control;
+
+  sigemptyset(&job_control);
+  sigaddset(&job_control, SIGTSTP);
+  sigaddset(&job_control, SIGTTIN);
+  sigaddset(&job_control, SIGTTOU);
+
+  short flags = POSIX_SPAWN_SETSIGDEF;
+
+  if (pgid >= 0)
+    flags |= POSIX_SPAWN_SETPGROUP;
+
+  if ((err = posix_spawnattr_setflags(&attr, flags)) == 0 && pgid >= 0)
+    err = posix_spawnattr_setpgroup(&attr, pgid);
+
+  if (!err)
+    err = posix_spawnattr_setsigdefault(&attr, &job_control);
+
+  if (!err)
+    err = __add_io_actions(&actions, io);
+
+  if (!err)
+    err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err != 0) {
+    fprintf(stderr, "ERROR: Failed to execute program: %s\n", strerror(err));
+    return -1;
+  }
+
+  return pid;
+}
+
+// Open a descriptor that becomes readable once a process exits
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
@@ -0,0 +1,75 @@
+/**
+ * @file spawner.h
+ *
+ * @brief Fast process creation for generic commands.
+ *
+ * Generic commands are started with posix_spawn() rather than fork() followed
+ * by exec(). The C library implements posix_spawn() with a vfork() style clone
+ * that shares the address space of quash with the child until the exec
+ * completes, so the cost of starting a program does not grow with the resident
+ * set size of quash. Pipes and redirects are expressed as spawn file actions.
+ */
+
+#ifndef SRC_SPAWNER_H
+#define SRC_SPAWNER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @brief Describes the standard streams of a process to be spawned
+ */
+typedef struct SpawnIO {
+  int in_fd;                /**< Descriptor to place on standard in or -1 to
+                             * inherit the standard in of quash */
+  int out_fd;               /**< Descriptor to place on standard out or -1 to
+                             * inherit the standard out of quash */
+  const char* redirect_in;  /**< File to open for standard in or NULL */
+  const char* redirect_out; /**< File to open for standard out or NULL */
+  bool append;              /**< Open @a redirect_out for appending rather than
+                             * truncating it */
+} SpawnIO;
+
+/**
+ * @brief Check if generic commands should be started with posix_spawn()
+ *
+ * Setting the QUASH_SPAWN environment variable to "fork" selects the original
+ * fork() and exec() path instead.
+ *
+ * @return True if the fast spawn path should be used
+ */
+bool use_fast_spawn();
+
+/**
+ * @brief Start a program with posix_spawn()
+ *
+ * Errors are reported to standard error in the same format as the fork() path.
+ *
+ * @param path Location of the executable as resolved by path_cache_lookup()
+ *
+ * @param args A NULL terminated array of strings. The first element is the
+ * executable.
+ *
+ * @param io Standard streams of the new process
+ *
+ * @param pgid Process group to place the new process in. Zero starts a new
+ * group led by the new process and -1 keeps the group of the caller.
+ *
+ * @return The process id of the new process or -1 if the process could not be
+ * started
+ *
+ * @sa SpawnIO
+ */
+pid_t spawn_generic(const char* path, char** args, SpawnIO io, pid_t pgid);
+
+/**
+ * @brief Open a process descriptor that becomes readable once a child exits
+ *
+ * @param pid Process id of the child
+ *
+ * @return A close-on-exec descriptor or -1 if the kernel does not support
+ * process descriptors
+ */
+int open_pidfd(pid_t pid);
+
+#endif